@@ -612,6 +612,7 @@
 
         #region Private Fields
         private const int m_numOfBits = 8;
+        private static readonly UInt16[] m_crcTable = CreateCRCTable();
         private ISerialDevice m_serialPort = null;
         #endregion
 
@@ -803,21 +804,25 @@
 
             for (int _byte = 0; _byte < length; ++_byte)
             {
-                crcFull = (UInt16)(crcFull ^ message[_byte]);
-
+                crcFull = (UInt16)((crcFull >> 8) ^ m_crcTable[(crcFull ^ message[_byte]) & 0xFF]);
+            }
+            res = crcFull;
+            return true;
+        }
+        //CRC-16/MODBUS of each byte value, so GetCRC does one lookup per byte instead of eight shifts
+        private static UInt16[] CreateCRCTable()
+        {
+            UInt16[] table = new UInt16[256];
+            for (int _byte = 0; _byte < 256; ++_byte)
+            {
+                UInt16 crc = (UInt16)_byte;
                 for (int _bit = 0; _bit < m_numOfBits; ++_bit)
                 {
-                    byte crcLsb = (byte)(crcFull & 0x0001);
-                    crcFull = (UInt16)((crcFull >> 1) & 0x7FFF);
-
-                    if (crcLsb == 1)
-                    {
-                        crcFull = (UInt16)(crcFull ^ 0xA001);
-                    }
+                    crc = (UInt16)((crc & 0x0001) != 0 ? (crc >> 1) ^ 0xA001 : crc >> 1);
                 }
+                table[_byte] = crc;
             }
-            res = crcFull;
-            return true;
+            return table;
         }
         #endregion
     }
@@ -0,0 +1,21 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MODBUS_CRC_H
+#define MODBUS_CRC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//CRC-16/MODBUS (reflected polynomial 0xA001, initial value 0xFFFF) of length bytes of message
+extern unsigned short modbus_crc16(const unsigned char * message, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*MODBUS_CRC_H*/
@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MODBUS_FRAME_H
+#define MODBUS_FRAME_H
+
+#include <stddef.h>
+
+//MBAP header (7 bytes) + PDU (up to 253 bytes)
+#define MODBUS_TCP_MAX_FRAME_LEN 260
+//address (1 byte) + PDU (up to 253 bytes) + CRC (2 bytes)
+#define MODBUS_RTU_MAX_FRAME_LEN 256
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//length of the Modbus TCP frame at the start of the len bytes of buf, 0 while the frame is incomplete, -1 if its MBAP header is invalid
+extern int modbus_tcp_frame_len(const unsigned char * buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*MODBUS_FRAME_H*/
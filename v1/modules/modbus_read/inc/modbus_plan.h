@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MODBUS_PLAN_H
+#define MODBUS_PLAN_H
+
+#include "modbus_read_common.h"
+
+//largest read one request may carry
+#define MODBUS_MAX_READ_BITS 2000
+#define MODBUS_MAX_READ_REGISTERS 125
+//wire cost of one more round trip in bytes: request and response header, plus either the TCP/IP headers of both segments or the two t3.5 silent intervals of a serial line
+#define MODBUS_ROUND_TRIP_COST_TCP (12 + 9 + 2 * 40)
+#define MODBUS_ROUND_TRIP_COST_COM (8 + 5 + 7)
+//values of coalesceReads: no merging, merging of adjacent and overlapping reads only, or reading across small gaps too
+#define MODBUS_COALESCE_OFF 0
+#define MODBUS_COALESCE_ADJACENT 1
+#define MODBUS_COALESCE_GAPS 2
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//splits the reads of the server that exceed what one request may carry, then merges adjacent and overlapping reads, and at MODBUS_COALESCE_GAPS reads whose gap costs fewer than round_trip_cost bytes
+extern void modbus_plan_read_operations(MODBUS_READ_CONFIG * config, int round_trip_cost);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*MODBUS_PLAN_H*/
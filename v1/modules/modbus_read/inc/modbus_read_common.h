@@ -4,8 +4,13 @@
 #ifndef MODBUS_READ_COMMON_H
 #define MODBUS_READ_COMMON_H
 
+#include <stdint.h>
 #include "parson.h"
+#include "modbus_stats.h"
 #define SOCKET_CLOSED (0)
+#define TIMESTRLEN 19
+//room for several pipelined Modbus TCP responses taken by one recv
+#define MODBUS_RX_BUFFER_SIZE 2048
 
 #ifdef WIN32
 
@@ -35,14 +40,40 @@
 
 #endif
 
+//latency phases of a server's hot path, each recorded in its own histogram
+#define MODBUS_PHASE_CONNECT 0
+#define MODBUS_PHASE_SEND 1
+#define MODBUS_PHASE_WAIT 2
+#define MODBUS_PHASE_DECODE 3
+#define MODBUS_PHASE_PUBLISH 4
+#define MODBUS_PHASE_COUNT 5
+
+//recorded by the worker polling the server and published by it every stats interval, then started over
+typedef struct MODBUS_READ_STATS_TAG
+{
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t timeouts;
+    uint32_t exceptions;
+    uint32_t reconnects;
+    uint32_t connect_failures;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    MODBUS_LATENCY_HISTOGRAM latency[MODBUS_PHASE_COUNT];
+} MODBUS_READ_STATS;
+
 typedef struct MODBUS_READ_CONFIG_TAG MODBUS_READ_CONFIG;
 typedef struct MODBUS_READ_OPERATION_TAG MODBUS_READ_OPERATION;
+typedef struct SERIAL_BUS_TAG SERIAL_BUS;
+typedef struct MODBUS_WRITE_TAG MODBUS_WRITE;
 
 typedef int(*encode_read_cb_type)(void*, void*, void*);
-typedef int(*encode_write_cb_type)(void*, void*, unsigned char, unsigned char, unsigned short, unsigned short);
-typedef int(*decode_response_cb_type)(void*, void*);
+typedef int(*encode_write_cb_type)(void*, void*, MODBUS_WRITE *);
+typedef int(*decode_response_cb_type)(MODBUS_READ_CONFIG *, unsigned char*, MODBUS_READ_OPERATION *);
 typedef int(*send_request_cb_type)(MODBUS_READ_CONFIG *, unsigned char*, int, unsigned char*);
 typedef void(*close_server_cb_type)(MODBUS_READ_CONFIG *);
+typedef int(*write_request_cb_type)(MODBUS_READ_CONFIG *, unsigned char*, int);
+typedef int(*read_response_cb_type)(MODBUS_READ_CONFIG *);
 
 //baud
 #define CONFIG_BAUD_9600 9600
@@ -67,12 +98,32 @@ typedef void(*close_server_cb_type)(MODBUS_READ_CONFIG *);
 struct MODBUS_READ_OPERATION_TAG
 {
     MODBUS_READ_OPERATION * p_next;
+    MODBUS_READ_OPERATION * p_segment;
     unsigned char unit_id;
     unsigned char function_code;
     unsigned short address;
     unsigned short length;
+    size_t read_interval;
+    int due;
+    int in_cycle;
+    int read_apart;
+    double deadband;
+    int deadband_percent;
+    size_t snapshot_interval;
+    unsigned short * last_values;
+    int cache_valid;
+    uint64_t next_snapshot;
     unsigned char read_request[256];
     int read_request_len;
+    unsigned char response[260];
+    int response_len;
+    unsigned short transaction_id;
+    int in_flight;
+    uint64_t response_deadline;
+    uint64_t sent_time_us;
+    uint32_t request_count;
+    uint32_t timeout_count;
+    uint32_t exception_count;
 };
 
 struct MODBUS_READ_CONFIG_TAG
@@ -86,7 +137,54 @@ struct MODBUS_READ_CONFIG_TAG
 	int sqlite_enabled;
     SOCKET_TYPE socks;
     FILE_TYPE files;
-    size_t time_check;
+    SERIAL_BUS * bus;
+    int due_count;
+    MODBUS_WRITE * writes;
+    size_t write_head;
+    size_t write_count;
+    MODBUS_READ_OPERATION * p_pending;
+    int cycle_active;
+    uint64_t cycle_deadline;
+    int cycle_status;
+    int in_flight;
+    int max_in_flight;
+    int connecting;
+    uint64_t connect_deadline;
+    size_t connect_timeout;
+    int breaker_state;
+    unsigned int breaker_failures;
+    uint64_t breaker_retry_time;
+    size_t response_timeout_min;
+    size_t response_timeout_max;
+    size_t response_timeout;
+    unsigned int srtt_us;
+    unsigned int rttvar_us;
+    int coalesce_reads;
+    unsigned int phase_seed;
+    size_t snapshot_interval;
+    int report_by_exception;
+    char * telemetry;
+    size_t telemetry_size;
+    size_t telemetry_len;
+    size_t telemetry_prefix_len;
+    char data_timestamp[TIMESTRLEN + 1];
+    char * sqlite_upsert;
+    size_t sqlite_len;
+    int shard;
+    int cpu;
+    unsigned short transaction_id;
+    unsigned char rx_buf[MODBUS_RX_BUFFER_SIZE];
+    int rx_len;
+    int rx_ready;
+    uint64_t rx_time_us;
+    int io_failed;
+    uint64_t connect_start_us;
+    size_t stats_interval;
+    uint64_t stats_time;
+    char * stats_message;
+    size_t stats_size;
+    MODBUS_READ_STATS stats;
+    unsigned int frame_gap_us;
 	unsigned int baud_rate;
 	unsigned char stop_bits;
 	unsigned char data_bits;
@@ -97,6 +195,15 @@ struct MODBUS_READ_CONFIG_TAG
     decode_response_cb_type decode_response_cb;
     send_request_cb_type send_request_cb;
     close_server_cb_type close_server_cb;
-}; /*this needs to be passed to the Module_Create function*/
+    write_request_cb_type write_request_cb;
+    read_response_cb_type read_response_cb;
+};
+
+//the servers and the module wide settings of "args"
+typedef struct MODBUS_READ_MODULE_CONFIG_TAG
+{
+    MODBUS_READ_CONFIG * servers;
+    size_t startup_timeout;
+}MODBUS_READ_MODULE_CONFIG; /*this needs to be passed to the Module_Create function*/
 
 #endif /*MODBUS_READ_COMMON_H*/
@@ -0,0 +1,32 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MODBUS_SCHEDULE_H
+#define MODBUS_SCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "modbus_read_common.h"
+
+typedef struct SCHEDULE_ENTRY_TAG
+{
+    uint64_t due_time;
+    MODBUS_READ_CONFIG * server;
+    MODBUS_READ_OPERATION * operation;
+}SCHEDULE_ENTRY;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//adds the read operation to the min-heap of *count entries ordered by due time, the heap must have room for one more entry
+extern void modbus_schedule_add(SCHEDULE_ENTRY * schedule, size_t * count, uint64_t due_time, MODBUS_READ_CONFIG * server, MODBUS_READ_OPERATION * operation);
+//marks every operation whose deadline has passed as due and reschedules it a whole number of intervals later, so polls do not drift
+extern void modbus_schedule_run(SCHEDULE_ENTRY * schedule, size_t count, uint64_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*MODBUS_SCHEDULE_H*/
@@ -0,0 +1,36 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MODBUS_STATS_H
+#define MODBUS_STATS_H
+
+#include <stdint.h>
+
+//log-linear buckets: the values below 4us are exact, each power of two above is split in 4, which keeps every bucket within 25% of its values, up to 2^26us (67s)
+#define MODBUS_HISTOGRAM_SUB_BITS 2
+#define MODBUS_HISTOGRAM_MAX_EXPONENT 26
+#define MODBUS_HISTOGRAM_BUCKETS ((MODBUS_HISTOGRAM_MAX_EXPONENT - MODBUS_HISTOGRAM_SUB_BITS + 2) << MODBUS_HISTOGRAM_SUB_BITS)
+
+typedef struct MODBUS_LATENCY_HISTOGRAM_TAG
+{
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t buckets[MODBUS_HISTOGRAM_BUCKETS];
+} MODBUS_LATENCY_HISTOGRAM;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//adds one sample, a value past the last bucket is counted in it
+extern void modbus_histogram_record(MODBUS_LATENCY_HISTOGRAM * histogram, uint64_t value_us);
+//upper bound of the bucket holding the percent-th percentile, never above the largest sample and the largest sample for the last bucket, 0 for an empty histogram
+extern uint32_t modbus_histogram_percentile(const MODBUS_LATENCY_HISTOGRAM * histogram, unsigned int percent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*MODBUS_STATS_H*/
@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MODBUS_WRITE_H
+#define MODBUS_WRITE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "modbus_read_common.h"
+
+#define WRITE_QUEUED 0
+#define WRITE_IN_FLIGHT 1
+#define WRITE_DONE 2
+
+//largest FC15/FC16 payload: 123 registers or 1968 coils
+#define MODBUS_MAX_WRITE_DATA 246
+#define MODBUS_MAX_WRITE_REGISTERS 123
+#define MODBUS_MAX_WRITE_BITS 1968
+
+//a write-back request queued by ModbusRead_Receive, sent and completed by the worker polling the server
+struct MODBUS_WRITE_TAG
+{
+    unsigned char uid;
+    unsigned char function_code;
+    unsigned short address;
+    unsigned short count;
+    unsigned char data[MODBUS_MAX_WRITE_DATA];//big endian registers or packed coils, as sent by FC16/FC15
+    int state;
+    int result;
+    unsigned short transaction_id;
+    uint64_t response_deadline;
+    uint64_t sent_time_us;
+    unsigned char request[260];
+    int request_len;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//true for the coil writes, FC5 and FC15
+extern bool modbus_write_is_coil(unsigned char function_code);
+//parses the comma separated "value" of a write command into data as FC16 registers or FC15 packed coils, returns the number of values or 0 when it is invalid
+extern unsigned short modbus_write_parse_values(const char * value_str, bool coils, unsigned char * data);
+//folds a write sent with function_code into target, still waiting to be sent, when it overlaps target or when both are FC15/FC16 writes of adjoining cells: the later values win, returns false when they cannot be merged
+extern bool modbus_write_merge(MODBUS_WRITE * target, unsigned char uid, unsigned char function_code, unsigned short address, unsigned short count, const unsigned char * data);
+//encodes the PDU of the write into buf, returns the PDU length
+extern int modbus_write_encode_pdu(unsigned char * buf, MODBUS_WRITE * modbus_write);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*MODBUS_WRITE_H*/
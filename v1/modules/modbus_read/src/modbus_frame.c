@@ -0,0 +1,17 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "modbus_frame.h"
+
+int modbus_tcp_frame_len(const unsigned char * buf, size_t len)
+{
+    int frame_len;
+
+    //the length field (bytes 4 and 5) counts the unit id and the PDU
+    if (len < 6)
+        return 0;
+    frame_len = ((buf[4] << 8) | buf[5]) + 6;
+    if (frame_len <= 7 || frame_len > MODBUS_TCP_MAX_FRAME_LEN)
+        return -1;
+    return ((size_t)frame_len <= len) ? frame_len : 0;
+}
@@ -0,0 +1,160 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#ifdef _CRTDBG_MAP_ALLOC
+#include <crtdbg.h>
+#endif
+#include "azure_c_shared_utility/gballoc.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "azure_c_shared_utility/xlogging.h"
+#include "modbus_plan.h"
+
+static unsigned short get_max_read_length(unsigned char function_code)
+{
+    return (function_code == 1 || function_code == 2) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+}
+static int compare_operations(const void * left, const void * right)
+{
+    const MODBUS_READ_OPERATION * left_operation = *(MODBUS_READ_OPERATION * const *)left;
+    const MODBUS_READ_OPERATION * right_operation = *(MODBUS_READ_OPERATION * const *)right;
+
+    if (left_operation->unit_id != right_operation->unit_id)
+        return left_operation->unit_id - right_operation->unit_id;
+    if (left_operation->function_code != right_operation->function_code)
+        return left_operation->function_code - right_operation->function_code;
+    if (left_operation->read_interval != right_operation->read_interval)
+        return (left_operation->read_interval < right_operation->read_interval) ? -1 : 1;
+    if (left_operation->address != right_operation->address)
+        return left_operation->address - right_operation->address;
+    return left_operation->length - right_operation->length;
+}
+static bool can_coalesce(int coalesce_reads, int round_trip_cost, MODBUS_READ_OPERATION * first, int block_end, MODBUS_READ_OPERATION * operation)
+{
+    int operation_end = operation->address + operation->length;
+    int gap = operation->address - block_end;
+    int gap_cost;
+
+    if (operation->unit_id != first->unit_id || operation->function_code != first->function_code ||
+        operation->read_interval != first->read_interval || operation->function_code < 1 || operation->function_code > 4)
+        return false;
+    if (((operation_end > block_end) ? operation_end : block_end) - first->address > get_max_read_length(operation->function_code))
+        return false;
+    if (gap <= 0)
+        return true;
+    //unmapped cells in a gap may make the device reject the whole read, so gaps are bridged only on request
+    if (coalesce_reads < MODBUS_COALESCE_GAPS)
+        return false;
+
+    //read across the gap only when its cells cost less wire time than one more request
+    gap_cost = (operation->function_code <= 2) ? (gap + 7) / 8 : gap * 2;
+    return gap_cost < round_trip_cost;
+}
+//splits reads longer than the protocol allows into chunks that are sent back to back and decoded into the same message
+static void split_read_operations(MODBUS_READ_CONFIG * config)
+{
+    for (MODBUS_READ_OPERATION * operation = config->p_operation; operation; operation = operation->p_next)
+    {
+        if (operation->function_code < 1 || operation->function_code > 4)
+            continue;
+
+        unsigned short max_length = get_max_read_length(operation->function_code);
+        while (operation->length > max_length)
+        {
+            MODBUS_READ_OPERATION * chunk = malloc(sizeof(MODBUS_READ_OPERATION));
+            if (chunk == NULL)
+            {
+                LogError("unable to malloc, read of %s at %u stays oversized", config->server_str, operation->address);
+                break;
+            }
+            memset(chunk, 0, sizeof(MODBUS_READ_OPERATION));
+            chunk->unit_id = operation->unit_id;
+            chunk->function_code = operation->function_code;
+            chunk->address = operation->address + max_length;
+            chunk->length = operation->length - max_length;
+            chunk->read_interval = operation->read_interval;
+            chunk->deadband = operation->deadband;
+            chunk->deadband_percent = operation->deadband_percent;
+            chunk->p_next = operation->p_next;
+            operation->length = max_length;
+            operation->p_next = chunk;
+            operation = chunk;
+        }
+    }
+}
+//merges operations of the same unit and function code with (nearly) adjacent ranges into single protocol-legal reads
+static void coalesce_read_operations(MODBUS_READ_CONFIG * config, int round_trip_cost)
+{
+    MODBUS_READ_OPERATION ** operations;
+    MODBUS_READ_OPERATION * planned = NULL;
+    MODBUS_READ_OPERATION ** tail = &planned;
+    size_t count = 0;
+    size_t operation_i = 0;
+
+    for (MODBUS_READ_OPERATION * operation = config->p_operation; operation; operation = operation->p_next)
+        count++;
+    if (!config->coalesce_reads || count < 2)
+        return;
+
+    operations = malloc(count * sizeof(MODBUS_READ_OPERATION *));
+    if (operations == NULL)
+    {
+        LogError("unable to malloc, reads of %s are not coalesced", config->server_str);
+        return;
+    }
+    for (MODBUS_READ_OPERATION * operation = config->p_operation; operation; operation = operation->p_next)
+        operations[operation_i++] = operation;
+    qsort(operations, count, sizeof(MODBUS_READ_OPERATION *), compare_operations);
+
+    operation_i = 0;
+    while (operation_i < count)
+    {
+        MODBUS_READ_OPERATION * first = operations[operation_i];
+        MODBUS_READ_OPERATION * block = first;
+        int block_end = first->address + first->length;
+        size_t next_i = operation_i + 1;
+
+        while (next_i < count && can_coalesce(config->coalesce_reads, round_trip_cost, first, block_end, operations[next_i]))
+        {
+            int operation_end = operations[next_i]->address + operations[next_i]->length;
+            block_end = (operation_end > block_end) ? operation_end : block_end;
+            next_i++;
+        }
+        if (next_i - operation_i > 1)
+        {
+            block = malloc(sizeof(MODBUS_READ_OPERATION));
+            if (block == NULL)
+            {
+                LogError("unable to malloc, reads of %s are not coalesced", config->server_str);
+                block = first;
+                next_i = operation_i + 1;
+            }
+            else
+            {
+                memset(block, 0, sizeof(MODBUS_READ_OPERATION));
+                block->unit_id = first->unit_id;
+                block->function_code = first->function_code;
+                block->address = first->address;
+                block->length = (unsigned short)(block_end - first->address);
+                block->read_interval = first->read_interval;
+                block->p_segment = first;
+                for (size_t segment_i = operation_i; segment_i + 1 < next_i; segment_i++)
+                    operations[segment_i]->p_next = operations[segment_i + 1];
+                operations[next_i - 1]->p_next = NULL;
+            }
+        }
+        *tail = block;
+        tail = &block->p_next;
+        operation_i = next_i;
+    }
+    *tail = NULL;
+    config->p_operation = planned;
+    free(operations);
+}
+void modbus_plan_read_operations(MODBUS_READ_CONFIG * config, int round_trip_cost)
+{
+    split_read_operations(config);
+    coalesce_read_operations(config, round_trip_cost);
+}
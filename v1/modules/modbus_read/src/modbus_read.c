@@ -1,6 +1,9 @@
 // Copyright (c) Microsoft. All rights reserved.
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
+#if !defined(WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE //sched_setaffinity
+#endif
 #include <stdlib.h>
 #ifdef _CRTDBG_MAP_ALLOC
 #include <crtdbg.h>
@@ -12,19 +15,72 @@
 
 #include "azure_c_shared_utility/threadapi.h"
 #include "modbus_read.h"
+#include "modbus_crc.h"
+#include "modbus_frame.h"
+#include "modbus_plan.h"
+#include "modbus_schedule.h"
+#include "modbus_write.h"
 #include "message.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/lock.h"
 
-typedef struct MODBUSREAD_HANDLE_DATA_TAG
+#ifndef WIN32
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sched.h>
+#endif
+
+//a worker can be pinned to the cpus of one affinity mask
+#ifdef WIN32
+#define MAX_AFFINITY_CPU (int)(sizeof(DWORD_PTR) * 8)
+#else
+#define MAX_AFFINITY_CPU CPU_SETSIZE
+#endif
+
+//a serial line shared by every server configured on the same port: one descriptor and one request on the wire at a time
+struct SERIAL_BUS_TAG
+{
+    FILE_TYPE files;
+    MODBUS_READ_CONFIG * owner;
+    uint64_t idle_time_us;
+    int member_count;
+};
+
+typedef struct MODBUSREAD_HANDLE_DATA_TAG MODBUSREAD_HANDLE_DATA;
+
+//a worker of the poll pool: polls the servers whose shard matches its index, shard 0 runs on the module thread and uses the module lock
+typedef struct POLL_SHARD_TAG
+{
+    MODBUSREAD_HANDLE_DATA * module;
+    size_t index;
+    THREAD_HANDLE threadHandle;
+    LOCK_HANDLE lockHandle;
+    int stopThread;
+    int cpu;
+#ifndef WIN32
+    int epollHandle;
+    int wakeHandle;
+#endif
+    SCHEDULE_ENTRY * schedule;
+    size_t schedule_count;
+}POLL_SHARD;
+
+struct MODBUSREAD_HANDLE_DATA_TAG
 {
     THREAD_HANDLE threadHandle;
     LOCK_HANDLE lockHandle;
     int stopThread;
     BROKER_HANDLE broker;
     MODBUS_READ_CONFIG * config;
+    POLL_SHARD * shards;
+    size_t shard_count;
+    size_t startup_timeout;
+    uint64_t startup_deadline;
 
-}MODBUSREAD_HANDLE_DATA;
+};
 
 #define CONNECTION_TCP 0
 #define CONNECTION_COM 1
@@ -32,10 +88,33 @@ typedef struct MODBUSREAD_HANDLE_DATA_TAG
 #define MODBUS_MESSAGE "modbus read"
 #define MODBUS_TCP_OFFSET 7
 #define MODBUS_COM_OFFSET 1
-#define TIMESTRLEN 19
-#define NUMOFBITS 8
 #define MACSTRLEN 17
 #define BUFSIZE 1024
+//the sqlite message is written in place around the sql text, which never needs JSON escaping
+#define SQLITE_COMMAND_PREFIX "{\"sqlCommand\":\""
+#define SQLITE_COMMAND_SUFFIX "\"}"
+//bounds of the adaptive response timeout, which starts at the ceiling until the first response is timed
+#define RESPONSE_TIMEOUT_MS 10000
+#define RESPONSE_TIMEOUT_MIN_MS 50
+#define MAX_WAIT_MS 1000
+#define CONNECT_TIMEOUT_MS 3000
+//a server is skipped after this many failures in a row, then probed with a backoff doubling from the min to the max
+#define BREAKER_CLOSED 0
+#define BREAKER_OPEN 1
+#define BREAKER_HALF_OPEN 2
+#define BREAKER_FAILURE_THRESHOLD 3
+#define BREAKER_BACKOFF_MIN_MS 1000
+#define BREAKER_BACKOFF_MAX_MS 60000
+#define MAX_EVENTS 64
+#define RTU_DRIVER_LATENCY_MS 20
+#define WRITE_QUEUE_LENGTH 16
+#define WRITE_RESULT_LEN 256
+//the counters and the latency summaries, then one entry per planned read
+#define STATS_MESSAGE_BASE_LEN 1024
+#define STATS_OPERATION_MAX_LEN 160
+//,"address_40001":"65535"
+#define TELEMETRY_CELL_MAX_LEN 25
+#define TELEMETRY_TIMESTAMP_KEY ",\"DataTimestamp\":\""
 
 /*
  ----------------------- --------
@@ -54,30 +133,26 @@ typedef struct MODBUSREAD_HANDLE_DATA_TAG
 */
 
 
-JSON_Value *root_value;
-JSON_Object *root_object;
-char *serialized_string;
-
-JSON_Value *sqlite_root_value;
-JSON_Object *sqlite_root_object;
-char *sqlite_serialized_string;
-
-char sqlite_upsert[BUFSIZE];
-char glob_currentTime[TIMESTRLEN + 1];
-char glob_currentMac[MACSTRLEN + 1];
-
+static void modbus_operation_cleanup(MODBUS_READ_OPERATION * operation)
+{
+    MODBUS_READ_OPERATION * modbus_operation = operation;
+    while (modbus_operation)
+    {
+        MODBUS_READ_OPERATION * temp_operation = modbus_operation;
+        modbus_operation = modbus_operation->p_next;
+        //a coalesced read owns the operations it was planned from
+        modbus_operation_cleanup(temp_operation->p_segment);
+        if (temp_operation->last_values != NULL)
+            free(temp_operation->last_values);
+        free(temp_operation);
+    }
+}
 static void modbus_config_cleanup(MODBUS_READ_CONFIG * config)
 {
     MODBUS_READ_CONFIG * modbus_config = config;
     while (modbus_config)
     {
-        MODBUS_READ_OPERATION * modbus_operation = modbus_config->p_operation;
-        while (modbus_operation)
-        {
-            MODBUS_READ_OPERATION * temp_operation = modbus_operation;
-            modbus_operation = modbus_operation->p_next;
-            free(temp_operation);
-        }
+        modbus_operation_cleanup(modbus_config->p_operation);
 
         MODBUS_READ_CONFIG * temp_config = modbus_config;
         modbus_config = modbus_config->p_next;
@@ -156,6 +231,8 @@ static bool addOneOperation(MODBUS_READ_OPERATION * operation, JSON_Object * ope
     const char* function = json_object_get_string(operation_obj, "functionCode");
     const char* address = json_object_get_string(operation_obj, "startingAddress");
     const char* length = json_object_get_string(operation_obj, "length");
+    const char* interval = json_object_get_string(operation_obj, "interval");
+    const char* deadband = json_object_get_string(operation_obj, "deadband");
 
     if (unit_id == NULL)
     {
@@ -192,6 +269,15 @@ static bool addOneOperation(MODBUS_READ_OPERATION * operation, JSON_Object * ope
     operation->function_code = atoi(function);
     operation->address = atoi(address);
     operation->length = atoi(length);
+    //0 polls the operation at the interval of its server
+    operation->read_interval = (interval != NULL) ? atoi(interval) : 0;
+    //"10" is an absolute deadband in raw units, "2.5%" is relative to the value reported last
+    if (deadband != NULL)
+    {
+        char * unit;
+        operation->deadband = strtod(deadband, &unit);
+        operation->deadband_percent = (*unit == '%');
+    }
 
     return result;
 }
@@ -212,6 +298,7 @@ static bool addAllOperations(MODBUS_READ_CONFIG * config, JSON_Array * operation
         }
         else
         {
+            memset(operation, 0, sizeof(MODBUS_READ_OPERATION));
             operation->p_next = config->p_operation;
             config->p_operation = operation;
             JSON_Object* operation_obj = json_array_get_object(operation_array, operation_i);
@@ -239,6 +326,14 @@ static bool addOneServer(MODBUS_READ_CONFIG * config, JSON_Object * arg_obj)
     const char* interval = json_object_get_string(arg_obj, "interval");
     const char* device_type = json_object_get_string(arg_obj, "deviceType");
     const char* sqlite_enabled = json_object_get_string(arg_obj, "sqliteEnabled");
+    const char* max_in_flight = json_object_get_string(arg_obj, "maxInFlight");
+    const char* coalesce_reads = json_object_get_string(arg_obj, "coalesceReads");
+    const char* phase_seed = json_object_get_string(arg_obj, "phaseSeed");
+    const char* snapshot_interval = json_object_get_string(arg_obj, "snapshotInterval");
+    const char* connect_timeout = json_object_get_string(arg_obj, "connectTimeout");
+    const char* response_timeout_min = json_object_get_string(arg_obj, "responseTimeoutMin");
+    const char* response_timeout_max = json_object_get_string(arg_obj, "responseTimeoutMax");
+    const char* stats_interval = json_object_get_string(arg_obj, "statsInterval");
     if (server_str == NULL || getServerType((char *)server_str) == CONNECTION_UNKNOWN)
     {
         /*Codes_SRS_MODBUS_READ_JSON_99_034: [ If the `args` object does not contain a value named "serverConnectionString" then ModbusRead_CreateFromJson shall fail and return NULL. ]*/
@@ -295,6 +390,61 @@ static bool addOneServer(MODBUS_READ_CONFIG * config, JSON_Object * arg_obj)
     config->read_interval = atoi(interval);
     config->sqlite_enabled = atoi(sqlite_enabled);
 
+    config->max_in_flight = 1;
+    if (max_in_flight != NULL)
+    {
+        config->max_in_flight = atoi(max_in_flight);
+    }
+
+    config->coalesce_reads = MODBUS_COALESCE_ADJACENT;
+    if (coalesce_reads != NULL)
+    {
+        config->coalesce_reads = atoi(coalesce_reads);
+    }
+
+    config->phase_seed = 0;
+    if (phase_seed != NULL)
+    {
+        config->phase_seed = (unsigned int)strtoul(phase_seed, NULL, 10);
+    }
+
+    config->shard = 0;
+    config->cpu = -1;
+
+    config->snapshot_interval = 0;
+    if (snapshot_interval != NULL)
+    {
+        config->snapshot_interval = atoi(snapshot_interval);
+    }
+
+    config->connect_timeout = CONNECT_TIMEOUT_MS;
+    if (connect_timeout != NULL)
+    {
+        config->connect_timeout = atoi(connect_timeout);
+    }
+
+    config->response_timeout_min = RESPONSE_TIMEOUT_MIN_MS;
+    if (response_timeout_min != NULL)
+    {
+        config->response_timeout_min = atoi(response_timeout_min);
+    }
+
+    config->response_timeout_max = RESPONSE_TIMEOUT_MS;
+    if (response_timeout_max != NULL)
+    {
+        config->response_timeout_max = atoi(response_timeout_max);
+    }
+    if (config->response_timeout_max < config->response_timeout_min)
+    {
+        config->response_timeout_max = config->response_timeout_min;
+    }
+
+    config->stats_interval = 0;
+    if (stats_interval != NULL)
+    {
+        config->stats_interval = atoi(stats_interval);
+    }
+
     config->baud_rate = CONFIG_BAUD_9600;
     if (baud_rate != NULL)
     {
@@ -348,6 +498,45 @@ static bool addOneServer(MODBUS_READ_CONFIG * config, JSON_Object * arg_obj)
 
     return result;
 }
+//deals the servers out to "workers" poll threads, the n-th entry of the comma separated "cpuAffinity" pins worker n, "startupTimeout" bounds the connects they start with
+static bool addWorkers(MODBUS_READ_MODULE_CONFIG * module_config, JSON_Object * arg_obj)
+{
+    const char* workers = json_object_get_string(arg_obj, "workers");
+    const char* cpu_affinity = json_object_get_string(arg_obj, "cpuAffinity");
+    const char* startup_timeout = json_object_get_string(arg_obj, "startupTimeout");
+    int worker_count = (workers != NULL) ? atoi(workers) : 1;
+    int server_i = 0;
+
+    if (worker_count < 1)
+    {
+        LogError("Invalid %s configuration", "workers");
+        return false;
+    }
+
+    for (MODBUS_READ_CONFIG * server_config = module_config->servers; server_config; server_config = server_config->p_next)
+    {
+        const char * cpu = cpu_affinity;
+        server_config->shard = server_i++ % worker_count;
+        for (int cpu_i = 0; cpu != NULL && cpu_i < server_config->shard; cpu_i++)
+        {
+            cpu = strchr(cpu, ',');
+            if (cpu != NULL)
+                cpu++;
+        }
+        server_config->cpu = -1;
+        if (cpu != NULL && *cpu != '\0' && *cpu != ',')
+        {
+            server_config->cpu = atoi(cpu);
+            if (server_config->cpu < 0 || server_config->cpu >= MAX_AFFINITY_CPU)
+            {
+                LogError("Invalid %s configuration", "cpuAffinity");
+                return false;
+            }
+        }
+    }
+    module_config->startup_timeout = (startup_timeout != NULL) ? atoi(startup_timeout) : 0;
+    return true;
+}
 static MODBUS_READ_CONFIG * addAllServers(JSON_Array * arg_array)
 {
     int arg_i;
@@ -401,31 +590,122 @@ static MODBUS_READ_CONFIG * addAllServers(JSON_Array * arg_array)
     }
     return ret_config;
 }
-static int get_crc(unsigned char * message, int length, unsigned short * out)//refer to J.J. Lee's code
+static int get_crc(unsigned char * message, int length, unsigned short * out)
 {
-    unsigned short crcFull = 0xFFFF;
-
     if (message == NULL || length <= 0)
         return -1;
 
-    for (int _byte = 0; _byte < length; ++_byte)
+    *out = modbus_crc16(message, (size_t)length);
+    return 0;
+}
+
+static uint64_t get_monotonic_ms(void)
+{
+#ifdef WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)(now.tv_nsec / 1000000);
+#endif
+}
+static uint64_t get_monotonic_us(void)
+{
+#ifdef WIN32
+    return (uint64_t)GetTickCount64() * 1000;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)(now.tv_nsec / 1000);
+#endif
+}
+static void record_latency(MODBUS_READ_CONFIG * config, int phase, uint64_t start_us)
+{
+    modbus_histogram_record(&config->stats.latency[phase], get_monotonic_us() - start_us);
+}
+static bool is_com_server(MODBUS_READ_CONFIG * server_config)
+{
+    return memcmp(server_config->server_str, "COM", 3) == 0;
+}
+static unsigned int get_baud_rate(MODBUS_READ_CONFIG * config)
+{
+    return (config->baud_rate > 0) ? config->baud_rate : CONFIG_BAUD_9600;
+}
+static unsigned int get_char_bits(MODBUS_READ_CONFIG * config)
+{
+    //start bit + data bits + parity bit + stop bits
+    return 1 + config->data_bits + ((config->parity == CONFIG_PARITY_NO) ? 0 : 1) + ((config->stop_bits == CONFIG_STOP_TWO) ? 2 : 1);
+}
+//3.5 character times of silence end an RTU frame, fixed at 1750us above 19200 baud
+static unsigned int get_frame_gap_us(MODBUS_READ_CONFIG * config)
+{
+    unsigned int baud_rate = get_baud_rate(config);
+
+    if (baud_rate > 19200)
+        return 1750;
+    return (unsigned int)(((uint64_t)get_char_bits(config) * 3500000 + baud_rate - 1) / baud_rate);
+}
+//time the bytes of RTU frames take on the line, nothing for tcp
+static uint64_t get_line_time_us(MODBUS_READ_CONFIG * config, int byte_count)
+{
+    if (!is_com_server(config))
+        return 0;
+    return (uint64_t)get_char_bits(config) * byte_count * 1000000 / get_baud_rate(config);
+}
+#ifndef WIN32
+static bool is_frame_crc_valid(unsigned char * frame, int frame_len)
+{
+    unsigned short crc;
+
+    if (frame_len < 4 || get_crc(frame, frame_len - 2, &crc) != 0)
+        return false;
+    //the CRC goes low byte first
+    return frame[frame_len - 2] == (crc & 0xFF) && frame[frame_len - 1] == (crc >> 8);
+}
+//longest silence accepted inside a frame: the inter-frame gap plus what the driver adds by delivering bytes in bursts
+static unsigned int get_frame_silence_us(MODBUS_READ_CONFIG * config)
+{
+    return config->frame_gap_us + RTU_DRIVER_LATENCY_MS * 1000;
+}
+static int wait_for_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    do
     {
-        crcFull = (unsigned short)(crcFull ^ message[_byte]);
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
 
-        for (int _bit = 0; _bit < NUMOFBITS; ++_bit)
-        {
-            char crcLsb = (char)(crcFull & 0x0001);
-            crcFull = (unsigned short)((crcFull >> 1) & 0x7FFF);
-            if (crcLsb == 1) 
-            { 
-                crcFull = (unsigned short)(crcFull ^ 0xA001); 
-            }
-        }
+    return ret;
+}
+static int get_com_response_len(unsigned char * response, int response_len)
+{
+    //Unit ID (1 byte) + Function Code (1 byte) + Data + CRC (2 bytes)
+    if (response_len < 2)
+        return 0;
+    if (response[1] & 0x80)//exception code
+        return 5;
+    switch (response[1])
+    {
+    case 1:
+    case 2:
+    case 3:
+    case 4://byte count + data
+        return (response_len < 3) ? 0 : response[2] + 5;
+    case 5:
+    case 6:
+    case 15:
+    case 16://echo of address + value/quantity
+        return 8;
+    default:
+        return -1;
     }
-    *out = crcFull;
-    return 0;
 }
-
+#endif
 static int send_request_com(MODBUS_READ_CONFIG * config, unsigned char * request, int request_len, unsigned char * response)
 {
     int write_size;
@@ -435,11 +715,13 @@ static int send_request_com(MODBUS_READ_CONFIG * config, unsigned char * request
     if (!WriteFile(config->files, request, request_len, &write_size, NULL))//Additional Address+PDU+Error
     {
         LogError("write failed");
+        config->io_failed = 1;
         return -1;
     }
     if (!ReadFile(config->files, response, 3, &read_size, NULL))
     {
         LogError("read failed");
+        config->io_failed = 1;
         return -1;
     }
 	else
@@ -447,6 +729,7 @@ static int send_request_com(MODBUS_READ_CONFIG * config, unsigned char * request
 		if (!ReadFile(config->files, response + 3, response[2] + 2, &read_size, NULL))
 		{
 			LogError("read failed");
+			config->io_failed = 1;
 			return -1;
 		}
 	}
@@ -455,13 +738,45 @@ static int send_request_com(MODBUS_READ_CONFIG * config, unsigned char * request
     if (write_size != request_len)
     {
         LogError("write failed");
+        config->io_failed = 1;
         return -1;
     }
 
-    read_size = read(config->files, response, 255);
-    if (read_size <= 0)
+    read_size = 0;
+    int expected_len = 0;
+    int wait_ms = (int)config->response_timeout;
+    while (expected_len == 0 || read_size < expected_len)
     {
-        LogError("read failed");
+        if (wait_for_readable(config->files, wait_ms) <= 0)
+        {
+            if (read_size == 0)
+                LogError("read timeout");
+            else
+                LogError("incomplete frame");
+            return -1;
+        }
+        int recv_size = read(config->files, response + read_size, MODBUS_RTU_MAX_FRAME_LEN - read_size);
+        if (recv_size <= 0)
+        {
+            if (recv_size < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            LogError("read failed");
+            config->io_failed = 1;
+            return -1;
+        }
+        read_size += recv_size;
+        //once the frame started only the inter-frame silence is waited for, not the response timeout
+        wait_ms = (int)(get_frame_silence_us(config) + 999) / 1000;
+        expected_len = get_com_response_len(response, read_size);
+        if (expected_len < 0 || expected_len > MODBUS_RTU_MAX_FRAME_LEN)
+        {
+            LogError("invalid response");
+            return -1;
+        }
+    }
+    if (!is_frame_crc_valid(response, expected_len))
+    {
+        LogError("CRC mismatch");
         return -1;
     }
 #endif
@@ -470,6 +785,15 @@ static int send_request_com(MODBUS_READ_CONFIG * config, unsigned char * request
     return 0;
 }
 
+static void set_transaction_id(unsigned char * buf, unsigned short transaction_id)
+{
+    buf[0] = (unsigned char)(transaction_id >> 8);
+    buf[1] = (unsigned char)(transaction_id & 0xFF);
+}
+static unsigned short get_transaction_id(unsigned char * buf)
+{
+    return (unsigned short)((buf[0] << 8) | buf[1]);
+}
 static int send_with_len_check(SOCKET_TYPE sock, unsigned char * request, int request_len)
 {
     int total_send = 0;
@@ -488,61 +812,169 @@ static int send_with_len_check(SOCKET_TYPE sock, unsigned char * request, int re
     return 0;
 }
 
-static int recv_with_len_check(SOCKET_TYPE sock, unsigned char * response)
+//drops the frame at the start of the receive buffer, a pipelined tcp response behind it moves up, a serial line keeps no leftover
+static void consume_response(MODBUS_READ_CONFIG * config, int frame_len)
+{
+    if (is_com_server(config) || frame_len >= config->rx_len)
+    {
+        config->rx_len = 0;
+    }
+    else
+    {
+        config->rx_len -= frame_len;
+        memmove(config->rx_buf, config->rx_buf + frame_len, config->rx_len);
+    }
+}
+//blocking reader of the synchronous path, shares the receive buffer of the connection
+static int recv_response_tcp(MODBUS_READ_CONFIG * config, unsigned char * response)
 {
-    int total_recv = 0;
-    int recv_size = 0;
-    unsigned short expected_len = 0;
-    while (total_recv < MODBUS_TCP_OFFSET || expected_len > (total_recv - 6))
+    int frame_len;
+    while ((frame_len = modbus_tcp_frame_len(config->rx_buf, config->rx_len)) == 0)
     {
-        recv_size = recv(sock, response + total_recv, (expected_len == 0) ? MODBUS_TCP_OFFSET : expected_len + 6 - total_recv, 0);
+#ifndef WIN32
+        if (wait_for_readable(config->socks, (int)config->response_timeout) <= 0)
+        {
+            LogError("recv timeout");
+            return SOCKET_ERROR;
+        }
+#endif
+        int recv_size = recv(config->socks, config->rx_buf + config->rx_len, sizeof(config->rx_buf) - config->rx_len, 0);
         if (recv_size == SOCKET_ERROR || recv_size == SOCKET_CLOSED)
         {
             LogError("recv failed");
             return recv_size;
         }
-        total_recv += recv_size;
-        if (total_recv >= MODBUS_TCP_OFFSET && expected_len == 0)
-            expected_len = ntohs(*(unsigned short *)(response + 4));
+        config->rx_len += recv_size;
+    }
+    if (frame_len < 0)
+    {
+        LogError("invalid MBAP length");
+        return SOCKET_ERROR;
     }
-    return total_recv;
+    memcpy(response, config->rx_buf, frame_len);
+    consume_response(config, frame_len);
+    return frame_len;
 }
 
 static int send_request_tcp(MODBUS_READ_CONFIG * config, unsigned char * request, int request_len, unsigned char * response)
 {
     int recv_size;
+    set_transaction_id(request, ++config->transaction_id);
     if (send_with_len_check(config->socks, request, request_len) < 0)//MBAP+PDU
     {
         LogError("send failed");
         return -1;
     }
-    recv_size = recv_with_len_check(config->socks, response);
-    if (recv_size == SOCKET_ERROR || recv_size == SOCKET_CLOSED)
+    do
     {
-        LogError("recv failed");
-        return -1;
-    }
+        //skip responses of requests that were abandoned earlier
+        recv_size = recv_response_tcp(config, response);
+        if (recv_size == SOCKET_ERROR || recv_size == SOCKET_CLOSED)
+        {
+            LogError("recv failed");
+            return -1;
+        }
+    } while (get_transaction_id(response) != config->transaction_id);
     if (response[MODBUS_TCP_OFFSET] == (request[MODBUS_TCP_OFFSET] + 128))
         return response[MODBUS_TCP_OFFSET + 1];
     return 0;
 }
-static void encode_write_PDU(unsigned char * buf, unsigned char functionCode, unsigned short startingAddress, unsigned short value)
+#ifndef WIN32
+static int write_request_tcp(MODBUS_READ_CONFIG * config, unsigned char * request, int request_len)
 {
-    unsigned short * _pU16;
-    //encoding PDU
-    buf[0] = functionCode;  //function code
-    _pU16 = (unsigned short *)(buf + 1);
-    *_pU16 = htons(startingAddress - 1);         //addr (2 bytes)
-    _pU16 = (unsigned short *)(buf + 3);
-    if (buf[0] == 5)//single coil
+    return send_with_len_check(config->socks, request, request_len);
+}
+static int write_request_com(MODBUS_READ_CONFIG * config, unsigned char * request, int request_len)
+{
+    (void)tcflush(config->files, TCIFLUSH);//drop stale bytes of an abandoned response
+    if (write(config->files, request, request_len) != request_len)
+    {
+        LogError("write failed");
+        config->io_failed = 1;
+        return -1;
+    }
+    return 0;
+}
+//returns the frame length once a complete response is buffered in rx_buf, 0 if more bytes are needed, -1 on error
+//one recv per readiness takes whatever has arrived, the frames are then parsed from the buffer, pipelined responses left over are returned by the next calls
+static int read_response_tcp(MODBUS_READ_CONFIG * config)
+{
+    int frame_len = modbus_tcp_frame_len(config->rx_buf, config->rx_len);
+    if (frame_len == 0 && config->rx_ready)
+    {
+        int space = (int)sizeof(config->rx_buf) - config->rx_len;
+        int recv_size = recv(config->socks, config->rx_buf + config->rx_len, space, 0);
+        if (recv_size == SOCKET_ERROR)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                config->rx_ready = 0;
+                return 0;
+            }
+            LogError("recv failed");
+            return -1;
+        }
+        if (recv_size == SOCKET_CLOSED)
+        {
+            LogError("connection closed by modbus server %s", config->server_str);
+            return -1;
+        }
+        //a short read drained the socket, the next recv waits until epoll reports more data
+        if (recv_size < space)
+            config->rx_ready = 0;
+        config->rx_len += recv_size;
+        frame_len = modbus_tcp_frame_len(config->rx_buf, config->rx_len);
+    }
+    if (frame_len < 0)
     {
-        *_pU16 = htons((value == 1) ? 0XFF00 : 0);
+        LogError("invalid MBAP length");
+        return -1;
     }
-    else if (buf[0] == 6)//single register
+    return frame_len;
+}
+static int read_response_com(MODBUS_READ_CONFIG * config)
+{
+    while (1)
     {
-        *_pU16 = htons(value);
+        int read_size = read(config->files, config->rx_buf + config->rx_len, sizeof(config->rx_buf) - config->rx_len);
+        if (read_size < 0)
+        {
+            if (errno == EAGAIN || errno == EINTR)
+                return 0;
+            LogError("read failed");
+            config->io_failed = 1;
+            return -1;
+        }
+        if (read_size == 0)
+            return 0;
+
+        uint64_t now_us = get_monotonic_us();
+        if (config->rx_len > 0 && now_us - config->rx_time_us > get_frame_silence_us(config))
+        {
+            LogError("incomplete frame from modbus server %s", config->server_str);
+            return -1;
+        }
+        config->rx_time_us = now_us;
+        config->rx_len += read_size;
+
+        int expected_len = get_com_response_len(config->rx_buf, config->rx_len);
+        if (expected_len < 0 || expected_len > MODBUS_RTU_MAX_FRAME_LEN)
+        {
+            LogError("invalid response");
+            return -1;
+        }
+        if (expected_len > 0 && config->rx_len >= expected_len)
+        {
+            if (!is_frame_crc_valid(config->rx_buf, expected_len))
+            {
+                LogError("CRC mismatch in response from modbus server %s", config->server_str);
+                return -1;
+            }
+            return expected_len;
+        }
     }
 }
+#endif
 static void encode_read_PDU(unsigned char * buf, MODBUS_READ_OPERATION * operation)
 {
     unsigned short * _pU16;
@@ -553,31 +985,31 @@ static void encode_read_PDU(unsigned char * buf, MODBUS_READ_OPERATION * operati
     _pU16 = (unsigned short *)(buf + 3);
     *_pU16 = htons(operation->length);         //length (2 bytes)
 }
-static void encode_MBAP(unsigned char * buf, int uid)
+static void encode_MBAP(unsigned char * buf, int uid, int pdu_len)
 {
     unsigned short * _pU16;
     //encoding MBAP
     _pU16 = (unsigned short *)buf;
-    *_pU16 = 0; //Transaction ID (2 bytes)
+    *_pU16 = 0; //Transaction ID (2 bytes), stamped when the request is sent
     buf[2] = 0;         //Protocol ID (2 bytes): 0 = MODBUS
     buf[3] = 0;
     _pU16 = (unsigned short *)(buf + 4);
-    *_pU16 = htons(6);         //Length (2 bytes)
+    *_pU16 = htons((unsigned short)(pdu_len + 1));         //Length (2 bytes): Unit ID + PDU
     buf[6] = uid;      //Unit ID (1 byte)
 }
-static int encode_write_request_tcp(unsigned char * buf, int * len, unsigned char uid, unsigned char functionCode, unsigned short startingAddres, unsigned short value)
+static int encode_write_request_tcp(unsigned char * buf, int * len, MODBUS_WRITE * modbus_write)
 {
-    encode_MBAP(buf, uid);
+    int pdu_len = modbus_write_encode_pdu(buf + MODBUS_TCP_OFFSET, modbus_write);
 
-    encode_write_PDU(buf + MODBUS_TCP_OFFSET, functionCode, startingAddres, value);
+    encode_MBAP(buf, modbus_write->uid, pdu_len);
 
-    *len = 12;
+    *len = MODBUS_TCP_OFFSET + pdu_len;
 
     return 0;
 }
 static int encode_read_request_tcp(unsigned char * buf, int * len, MODBUS_READ_OPERATION * operation)
 {
-    encode_MBAP(buf, operation->unit_id);
+    encode_MBAP(buf, operation->unit_id, 5);
 
     encode_read_PDU(buf + MODBUS_TCP_OFFSET, operation);
 
@@ -585,23 +1017,24 @@ static int encode_read_request_tcp(unsigned char * buf, int * len, MODBUS_READ_O
 
     return 0;
 }
-static int encode_write_request_com(unsigned char * buf, int * len, unsigned char uid, unsigned char functionCode, unsigned short startingAddress, unsigned short value)
+static int encode_write_request_com(unsigned char * buf, int * len, MODBUS_WRITE * modbus_write)
 {
     unsigned short * _pU16;
     unsigned short crc;
     int ret = 0;
+    int pdu_len;
 
-    buf[0] = uid;      //Unit ID (1 byte)
+    buf[0] = modbus_write->uid;      //Unit ID (1 byte)
 
-    encode_write_PDU(buf + MODBUS_COM_OFFSET, functionCode, startingAddress, value);
+    pdu_len = modbus_write_encode_pdu(buf + MODBUS_COM_OFFSET, modbus_write);
 
-    if (get_crc(buf, 6, &crc) == -1)
+    if (get_crc(buf, MODBUS_COM_OFFSET + pdu_len, &crc) == -1)
         ret = -1;
     else 
     {
-        _pU16 = (unsigned short *)(buf + 6);
+        _pU16 = (unsigned short *)(buf + MODBUS_COM_OFFSET + pdu_len);
         *_pU16 = crc;
-        *len = 8;
+        *len = MODBUS_COM_OFFSET + pdu_len + 2;
     }
 
     return ret;
@@ -628,109 +1061,201 @@ static int encode_read_request_com(unsigned char * buf, int * len, MODBUS_READ_O
 
     return ret;
 }
-static int decode_response_PDU(unsigned char * buf, MODBUS_READ_OPERATION* operation)
+//true when the value moved out of the deadband around the value reported last
+static bool is_outside_deadband(MODBUS_READ_OPERATION * segment, unsigned short last_value, unsigned short value)
+{
+    double change = (value > last_value) ? value - last_value : last_value - value;
+
+    if (segment->deadband_percent)
+        return change * 100 > segment->deadband * last_value;
+    return change > segment->deadband;
+}
+//writes value in decimal, left padded with zeros to min_digits, and returns the number of characters written
+static size_t write_decimal(char * out, unsigned int value, size_t min_digits)
+{
+    char digits[10];
+    size_t digit_count = 0;
+    size_t len = 0;
+
+    do
+    {
+        digits[digit_count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (min_digits > digit_count)
+    {
+        out[len++] = '0';
+        min_digits--;
+    }
+    while (digit_count > 0)
+    {
+        out[len++] = digits[--digit_count];
+    }
+    return len;
+}
+static void write_telemetry(MODBUS_READ_CONFIG * config, const char * text, size_t len)
+{
+    memcpy(config->telemetry + config->telemetry_len, text, len);
+    config->telemetry_len += len;
+}
+//appends ,"address_<digit><address>":"<value>" in the same format the cells always had, %01X for bits and %05u for registers
+static bool write_telemetry_cell(MODBUS_READ_CONFIG * config, unsigned char start_digit, unsigned short address, unsigned short value, int step_size)
+{
+    char * out;
+
+    if (config->telemetry == NULL || config->telemetry_len + TELEMETRY_CELL_MAX_LEN + 2 > config->telemetry_size)
+        return false;
+
+    out = config->telemetry + config->telemetry_len;
+    memcpy(out, ",\"address_", 10);
+    out += 10;
+    *out++ = (char)('0' + start_digit);
+    out += write_decimal(out, address, 4);
+    memcpy(out, "\":\"", 3);
+    out += 3;
+    out += write_decimal(out, value, (step_size == 1) ? 1 : 5);
+    *out++ = '"';
+    config->telemetry_len = out - config->telemetry;
+    return true;
+}
+//returns the number of cells put into the message
+static int decode_segment(MODBUS_READ_CONFIG * config, unsigned char * buf, MODBUS_READ_OPERATION * operation, MODBUS_READ_OPERATION * segment)
 {
     unsigned char byte_count = buf[1];
-    unsigned char index = 0;
+    unsigned short first = segment->address - operation->address;
     unsigned short count;
+    unsigned short index = 0;
     int step_size = 0;
     unsigned char start_digit;
     char tempKey[64];
     char tempValue[64];
+    int reported = 0;
+    bool snapshot = true;
 
     if (buf[0] == 1 || buf[0] == 2)//discrete input or coil status 1 bit
     {
         count = (byte_count * 8);
-        count = (count > operation->length) ? operation->length : count;
         step_size = 1;
         start_digit = buf[0] - 1;
     }
-    else if (buf[0] == 3 || buf[0] == 4)//register 16 bits
+    else//register 16 bits
     {
-        count = byte_count;
+        count = byte_count / 2;
         step_size = 2;
         start_digit = (buf[0] == 3) ? 4 : 3;
     }
-    else
-        return -1;
+    //only the cells of this segment, a coalesced read may span gaps that nobody asked for
+    count = (count > first) ? count - first : 0;
+    count = (count > segment->length) ? segment->length : count;
+
+    if (segment->last_values != NULL)
+    {
+        //report by exception, except for the periodic full snapshot that lets consumers resynchronize
+        uint64_t now = get_monotonic_ms();
+        snapshot = !segment->cache_valid || (segment->snapshot_interval > 0 && now >= segment->next_snapshot);
+        if (snapshot)
+            segment->next_snapshot = now + segment->snapshot_interval;
+    }
 
     while (count > index)
     {
+        unsigned short cell = first + index;
+        unsigned short value;
         memset(tempKey, 0, sizeof(tempKey));
         memset(tempValue, 0, sizeof(tempValue));
         if (step_size == 1)
         {
-            LogInfo("status %01X%04u: <%01X>\n", start_digit, operation->address + index, (buf[2 + (index / 8)] >> (index % 8)) & 1);
-
-            if (SNPRINTF_S(tempKey, sizeof(tempKey), "address_%01X%04u", start_digit, operation->address + index)<0 ||
-                SNPRINTF_S(tempValue, sizeof(tempValue), "%01X", (buf[2 + (index / 8)] >> (index % 8)) & 1)< 0)
-            {
-                LogError("Failed to set message text");
-            }
-            else
-            {
-                json_object_set_string(root_object, tempKey, tempValue);
-            }
+            value = (buf[2 + (cell / 8)] >> (cell % 8)) & 1;
+            LogInfo("status %01X%04u: <%01X>\n", start_digit, segment->address + index, value);
         }
         else
         {
-            LogInfo("register %01X%04u: <%02X%02X>\n", start_digit, operation->address + (index / 2), buf[2 + index], buf[3 + index]);
+            value = buf[2 + cell * 2] * (0x100) + buf[3 + cell * 2];
+            LogInfo("register %01X%04u: <%02X%02X>\n", start_digit, segment->address + index, buf[2 + cell * 2], buf[3 + cell * 2]);
+        }
 
-            if (SNPRINTF_S(tempKey, sizeof(tempKey), "address_%01X%04u", start_digit, operation->address + (index / 2))<0 ||
-                SNPRINTF_S(tempValue, sizeof(tempValue), "%05u", buf[2 + index] * (0x100) + buf[3 + index])< 0)
-            {
-                LogError("Failed to set message text");
-            }
-            else
-            {
-                json_object_set_string(root_object, tempKey, tempValue);
-            }
+        if (!snapshot && !is_outside_deadband(segment, segment->last_values[index], value))
+        {
+            index++;
+            continue;
         }
-        if (strlen(tempKey) > 0 && strlen(tempValue) > 0)
+        if (segment->last_values != NULL)
+            segment->last_values[index] = value;
+
+        if (!write_telemetry_cell(config, start_digit, segment->address + index, value, step_size))
+        {
+            LogError("Failed to set message text");
+        }
+        else
         {
-            int offset = strlen(sqlite_upsert);
-            SNPRINTF_S(sqlite_upsert + offset, BUFSIZE - 1 - offset, "INSERT INTO MODBUS(VALUE,ADDRESS,MAC,DATETIME) VALUES(%s,%s,'%s','%s');", tempValue, tempKey + 8, glob_currentMac, glob_currentTime);
+            reported++;
+        }
+        if (config->sqlite_enabled == 1 &&
+            SNPRINTF_S(tempKey, sizeof(tempKey), "address_%01X%04u", start_digit, segment->address + index) > 0 &&
+            SNPRINTF_S(tempValue, sizeof(tempValue), (step_size == 1) ? "%01X" : "%05u", value) > 0)
+        {
+            //room is kept for the closing of the message, a statement that does not fit is left out whole
+            size_t room = BUFSIZE - (sizeof(SQLITE_COMMAND_SUFFIX) - 1) - config->sqlite_len;
+            int statement_len = SNPRINTF_S(config->sqlite_upsert + config->sqlite_len, room, "INSERT INTO MODBUS(VALUE,ADDRESS,MAC,DATETIME) VALUES(%s,%s,'%s','%s');", tempValue, tempKey + 8, config->mac_address, config->data_timestamp);
+            if (statement_len > 0 && (size_t)statement_len < room)
+                config->sqlite_len += statement_len;
+            else
+                config->sqlite_upsert[config->sqlite_len] = '\0';
             /* upsert
-            int offset = strlen(sqlite_upsert);
-            SNPRINTF_S(sqlite_upsert + offset, BUFSIZE - 1 - offset, "UPDATE MODBUS SET VALUE=%s WHERE ADDRESS=%s;", tempValue, tempKey + 8);
-            int offset = strlen(sqlite_upsert);
-            SNPRINTF_S(sqlite_upsert + offset, BUFSIZE - 1 - offset, "INSERT INTO MODBUS(VALUE,ADDRESS) SELECT %s, %s WHERE NOT EXISTS(SELECT changes() AS change FROM MODBUS WHERE change <> 0);", tempValue, tempKey + 8);
+            int offset = strlen(config->sqlite_upsert);
+            SNPRINTF_S(config->sqlite_upsert + offset, BUFSIZE - 1 - offset, "UPDATE MODBUS SET VALUE=%s WHERE ADDRESS=%s;", tempValue, tempKey + 8);
+            int offset = strlen(config->sqlite_upsert);
+            SNPRINTF_S(config->sqlite_upsert + offset, BUFSIZE - 1 - offset, "INSERT INTO MODBUS(VALUE,ADDRESS) SELECT %s, %s WHERE NOT EXISTS(SELECT changes() AS change FROM MODBUS WHERE change <> 0);", tempValue, tempKey + 8);
             */
         }
-        index += step_size;
+        index++;
     }
-    return 0;
+    //a short response leaves cells without a value to compare against
+    if (snapshot && segment->last_values != NULL)
+        segment->cache_valid = (count == segment->length);
+    return reported;
 }
-static void decode_response_tcp(unsigned char * buf, MODBUS_READ_OPERATION* operation)
+//returns the number of cells put into the message, or -1 for a response that is not a read
+static int decode_response_PDU(MODBUS_READ_CONFIG * config, unsigned char * buf, MODBUS_READ_OPERATION* operation)
 {
-    decode_response_PDU(buf + MODBUS_TCP_OFFSET, operation);
+    int reported = 0;
+
+    if (buf[0] < 1 || buf[0] > 4)
+        return -1;
+
+    if (operation->p_segment == NULL)
+    {
+        reported = decode_segment(config, buf, operation, operation);
+    }
+    else
+    {
+        //split a coalesced read back into the operations it was planned from
+        MODBUS_READ_OPERATION * segment = operation->p_segment;
+        while (segment)
+        {
+            reported += decode_segment(config, buf, operation, segment);
+            segment = segment->p_next;
+        }
+    }
+    return reported;
+}
+static int decode_response_tcp(MODBUS_READ_CONFIG * config, unsigned char * buf, MODBUS_READ_OPERATION* operation)
+{
+    return decode_response_PDU(config, buf + MODBUS_TCP_OFFSET, operation);
 }
-static void decode_response_com(unsigned char * buf, MODBUS_READ_OPERATION* operation)
+static int decode_response_com(MODBUS_READ_CONFIG * config, unsigned char * buf, MODBUS_READ_OPERATION* operation)
 {
-    decode_response_PDU(buf + MODBUS_COM_OFFSET, operation);
+    return decode_response_PDU(config, buf + MODBUS_COM_OFFSET, operation);
 }
-static void modbus_publish(BROKER_HANDLE broker, MODULE_HANDLE * handle, MESSAGE_CONFIG * msgConfig, int sqlite_enabled)
+static void modbus_publish(BROKER_HANDLE broker, MODULE_HANDLE * handle, MESSAGE_CONFIG * msgConfig, const char * source, size_t size)
 {
-    char * source;
-    JSON_Value * root;
     MESSAGE_HANDLE modbusMessage;
-    if (sqlite_enabled == 1)
-    {
-        //to sqlite Command
-        source = sqlite_serialized_string;
-        root = sqlite_root_value;
-    }
-    else
-    {
-        //to IoTHub message
-        source = serialized_string;
-        root = root_value;
-    }
-
-    msgConfig->source = (const unsigned char *)source;
-    msgConfig->size = strlen(source);
-    modbusMessage = Message_Create(msgConfig);
-    if (modbusMessage == NULL)
+
+    //payloads are built in place in buffers each server allocates once, the SDK's CONSTBUFFER cannot adopt them so Message_Create makes the one copy
+    msgConfig->source = (const unsigned char *)source;
+    msgConfig->size = size;
+    modbusMessage = Message_Create(msgConfig);
+    if (modbusMessage == NULL)
     {
         LogError("unable to create \"modbus read\" message");
     }
@@ -739,8 +1264,6 @@ static void modbus_publish(BROKER_HANDLE broker, MODULE_HANDLE * handle, MESSAGE
         (void)Broker_Publish(broker, handle, modbusMessage);
         Message_Destroy(modbusMessage);
     }
-    json_free_serialized_string(source);
-    json_value_free(root);
 }
 void close_server_tcp(MODBUS_READ_CONFIG * config)
 {
@@ -751,17 +1274,24 @@ void close_server_tcp(MODBUS_READ_CONFIG * config)
 #else
         close(config->socks);
 #endif
+        config->socks = INVALID_SOCKET;
     }
 }
 void close_server_com(MODBUS_READ_CONFIG * config)
 {
+    //a shared port is closed once, by the first server still holding its descriptor
+    if (config->bus != NULL && config->files != config->bus->files)
+        config->files = INVALID_FILE;
     if (config->files != INVALID_FILE)
     {
+        if (config->bus != NULL)
+            config->bus->files = INVALID_FILE;
 #ifdef WIN32
         CloseHandle(config->files);
 #else
         close(config->files);
 #endif
+        config->files = INVALID_FILE;
     }
 }
 void modbus_cleanup(MODBUS_READ_CONFIG * config)
@@ -769,15 +1299,19 @@ void modbus_cleanup(MODBUS_READ_CONFIG * config)
     MODBUS_READ_CONFIG * modbus_config = config;
     while (modbus_config)
     {
-        MODBUS_READ_OPERATION * modbus_operation = modbus_config->p_operation;
-        while (modbus_operation)
-        {
-            MODBUS_READ_OPERATION * temp_operation = modbus_operation;
-            modbus_operation = modbus_operation->p_next;
-            free(temp_operation);
-        }
+        modbus_operation_cleanup(modbus_config->p_operation);
         if (modbus_config->close_server_cb)
             modbus_config->close_server_cb(modbus_config);
+        if (modbus_config->bus != NULL && --modbus_config->bus->member_count == 0)
+            free(modbus_config->bus);
+        if (modbus_config->writes != NULL)
+            free(modbus_config->writes);
+        if (modbus_config->telemetry != NULL)
+            free(modbus_config->telemetry);
+        if (modbus_config->sqlite_upsert != NULL)
+            free(modbus_config->sqlite_upsert);
+        if (modbus_config->stats_message != NULL)
+            free(modbus_config->stats_message);
 
         MODBUS_READ_CONFIG * temp_config = modbus_config;
         modbus_config = modbus_config->p_next;
@@ -798,7 +1332,13 @@ static int get_timestamp(char* timetemp)
     }
     else
     {
-        struct tm* t = localtime(&temp);
+        //localtime shares one static result between threads
+        struct tm time_fields;
+#ifdef WIN32
+        struct tm* t = (localtime_s(&time_fields, &temp) == 0) ? &time_fields : NULL;
+#else
+        struct tm* t = localtime_r(&temp, &time_fields);
+#endif
         if (t == NULL)
         {
             LogError("localtime failed");
@@ -815,70 +1355,58 @@ static int get_timestamp(char* timetemp)
     }
     return 0;
 }
-static int process_operation(MODBUS_READ_CONFIG * config, MODBUS_READ_OPERATION * operation)
+//decodes the responses collected by the current cycle into the telemetry (and sqlite) payload, *has_changes is false when no value changed
+static int process_operation(MODBUS_READ_CONFIG * config, MODBUS_READ_OPERATION * operation, bool * has_changes)
 {
-    unsigned char response[256];
-    int request_len = 0;
     int ret = 0;
+    int reported = 0;
 
-    root_value = json_value_init_object();
-    root_object = json_value_get_object(root_value);
+    *has_changes = false;
 
-    if (config->sqlite_enabled == 1)
+    //the telemetry buffer could not be allocated at startup, the server is still polled but publishes nothing
+    if (config->telemetry == NULL)
     {
-        sqlite_root_value = json_value_init_object();
-        sqlite_root_object = json_value_get_object(sqlite_root_value);
+        return ret;
     }
-    char timetemp[TIMESTRLEN + 1] = { 0 };
 
-    if (get_timestamp(timetemp) != 0)
+    if (get_timestamp(config->data_timestamp) != 0)
     {
         ret = -1;
         return ret;
     }
-    memset(sqlite_upsert, 0, sizeof(sqlite_upsert));
-    memcpy(glob_currentTime, timetemp, strlen(timetemp));
-    memcpy(glob_currentMac, config->mac_address, strlen(config->mac_address));
-
-    glob_currentTime[strlen(timetemp)] = '\0';
-    glob_currentMac[strlen(config->mac_address)] = '\0';
+    if (config->sqlite_enabled == 1)
+    {
+        config->sqlite_len = sizeof(SQLITE_COMMAND_PREFIX) - 1;
+        memcpy(config->sqlite_upsert, SQLITE_COMMAND_PREFIX, config->sqlite_len + 1);
+    }
 
-    json_object_set_string(root_object, "DataTimestamp", timetemp);
-    json_object_set_string(root_object, "mac_address", config->mac_address);
-    json_object_set_string(root_object, "device_type", config->device_type);
+    //the mac_address and device_type fragment never changes and stays in the buffer, TIMESTRLEN characters never need escaping
+    config->telemetry_len = config->telemetry_prefix_len;
+    write_telemetry(config, TELEMETRY_TIMESTAMP_KEY, sizeof(TELEMETRY_TIMESTAMP_KEY) - 1);
+    write_telemetry(config, config->data_timestamp, strlen(config->data_timestamp));
+    write_telemetry(config, "\"", 1);
 
     MODBUS_READ_OPERATION * request_operation = operation;
     while (request_operation) 
     {
-        int send_ret = -1;
-        if (config->send_request_cb)
-            send_ret = config->send_request_cb(config, request_operation->read_request, operation->read_request_len, response);
-        if (send_ret == -1)
-        {
-            LogError("send request failed");
-            ret = 1;
-        }
-        else if (send_ret > 0)
+        if (config->decode_response_cb && request_operation->in_cycle)
         {
-            LogError("Exception occured, error code : %X\n", send_ret);
-            ret = 1;
-        }
-        else
-        {
-            if (config->decode_response_cb)
-                config->decode_response_cb(response, request_operation);
+            int decoded = config->decode_response_cb(config, request_operation->response, request_operation);
+            if (decoded > 0)
+                reported += decoded;
         }
         request_operation = request_operation->p_next;
     }
 
-    serialized_string = json_serialize_to_string_pretty(root_value);
-
-    if (config->sqlite_enabled == 1)
+    if (reported == 0 && config->report_by_exception)
     {
-        json_object_set_string(sqlite_root_object, "sqlCommand", sqlite_upsert);//testing
-        sqlite_serialized_string = json_serialize_to_string_pretty(sqlite_root_value);
+        return ret;
     }
 
+    write_telemetry(config, "}", 1);
+    config->telemetry[config->telemetry_len] = '\0';
+    *has_changes = true;
+
     return ret;
 }
 static MODBUS_READ_CONFIG * get_config_by_mac(const char * mac_address, MODBUS_READ_CONFIG * config)
@@ -916,6 +1444,22 @@ static MODBUS_READ_CONFIG * get_config_by_mac(const char * mac_address, MODBUS_R
     free(result);
     return NULL;
 }
+#ifndef WIN32
+static speed_t get_com_speed(unsigned int baud_rate)
+{
+    switch (baud_rate)
+    {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    default: return B9600;
+    }
+}
+#endif
 static void set_com_state(MODBUS_READ_CONFIG * config)
 {
 #ifdef WIN32
@@ -961,7 +1505,19 @@ static void set_com_state(MODBUS_READ_CONFIG * config)
 
     struct termios settings;
     tcgetattr(config->files, &settings);
-    cfsetospeed(&settings, config->baud_rate); /* baud rate */
+    cfsetospeed(&settings, get_com_speed(config->baud_rate)); /* baud rate */
+    cfsetispeed(&settings, get_com_speed(config->baud_rate));
+
+    /* raw bytes, no line discipline */
+    settings.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    settings.c_oflag &= ~OPOST;
+    settings.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    settings.c_cflag |= CLOCAL | CREAD;
+    settings.c_cflag &= ~CSIZE;
+    settings.c_cflag |= (config->data_bits == 7) ? CS7 : CS8;
+    /* read returns what is buffered right away, frames are timed with poll */
+    settings.c_cc[VMIN] = 0;
+    settings.c_cc[VTIME] = 0;
 
     if (config->parity == CONFIG_PARITY_NO)
     {
@@ -998,11 +1554,13 @@ static void set_com_state(MODBUS_READ_CONFIG * config)
 #endif
 
 }
-static SOCKET_TYPE connect_modbus_server_tcp(const char * server_ip)
+//on Linux the connect goes on in the background, *in_progress tells the worker to wait for the socket to turn writable
+static SOCKET_TYPE connect_modbus_server_tcp(const char * server_ip, size_t timeout_ms, int * in_progress)
 {
     SOCKET_TYPE s;
     struct sockaddr_in server;
 
+    *in_progress = 0;
     if ((s = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET)
     {
         LogError("Could not create socket");
@@ -1013,16 +1571,27 @@ static SOCKET_TYPE connect_modbus_server_tcp(const char * server_ip)
         server.sin_addr.s_addr = inet_addr(server_ip);
         server.sin_family = AF_INET;
         server.sin_port = htons(502);
+#ifdef WIN32
         if (connect(s, (struct sockaddr *)&server, sizeof(server)) < 0)
         {
             LogError("connect error");
+            closesocket(s);
+            s = INVALID_SOCKET;
+        }
+#else
+        if (fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) < 0 ||
+            (connect(s, (struct sockaddr *)&server, sizeof(server)) < 0 && !(*in_progress = (errno == EINPROGRESS))))
+        {
+            LogError("connect error");
+            close(s);
             s = INVALID_SOCKET;
         }
+#endif
         else
         {
             struct timeval timeout;      
-            timeout.tv_sec = 10;
-            timeout.tv_usec = 0;
+            timeout.tv_sec = (long)(timeout_ms / 1000);
+            timeout.tv_usec = (long)(timeout_ms % 1000) * 1000;
 
             if (setsockopt (s, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout,
                         sizeof(timeout)) < 0)
@@ -1053,281 +1622,1780 @@ static FILE_TYPE connect_modbus_server_com(int port)
     f = CreateFile(file, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 #else
     SNPRINTF_S(file, 32, "/dev/ttyS%d", port - 1);
-    f = open(file, O_RDWR | O_NOCTTY);
+    //without O_NONBLOCK the open waits for the carrier of a modem line
+    f = open(file, O_RDWR | O_NOCTTY | O_NONBLOCK);
 #endif
 
     return f;
 }
-static int connect_modbus_server(MODBUS_READ_CONFIG * server_config)
+static bool is_server_connected(MODBUS_READ_CONFIG * server_config)
 {
-    if (memcmp(server_config->server_str, "COM", 3) == 0)
-    {
-        server_config->files = connect_modbus_server_com(atoi(server_config->server_str + 3));
-        if (server_config->files == INVALID_FILE)
-        {
-            return 1;
-        }
-    }
-    else
+    if (is_com_server(server_config))
+        return server_config->files != INVALID_FILE && (server_config->bus == NULL || server_config->files == server_config->bus->files);
+    return server_config->socks != INVALID_SOCKET && !server_config->connecting;
+}
+static void create_value_cache(MODBUS_READ_CONFIG * config, MODBUS_READ_OPERATION * operation)
+{
+    //without a snapshot interval only the operations with a deadband report by exception
+    if (config->snapshot_interval == 0 && operation->deadband <= 0)
+        return;
+    config->report_by_exception = 1;
+    operation->snapshot_interval = config->snapshot_interval;
+    operation->last_values = malloc(operation->length * sizeof(unsigned short));
+    if (operation->last_values == NULL)
     {
-        server_config->socks = connect_modbus_server_tcp(server_config->server_str);
-
-        if (server_config->socks == INVALID_SOCKET)
-        {
-            return 1;
-        }
+        LogError("unable to malloc, read of %s at %u reports every value", config->server_str, operation->address);
     }
-    return 0;
 }
-static int modbusReadThread(void *param)
+//the most reads the server sends: its operations, and the segments of a merged read once it is read apart
+static size_t get_read_count(MODBUS_READ_CONFIG * config)
 {
-    MODBUSREAD_HANDLE_DATA* handleData = param;
-    MESSAGE_CONFIG msgConfig;
-    MESSAGE_CONFIG sqlite_msgConfig;
-
-    MODBUS_READ_CONFIG * server_config = handleData->config;
-
-#ifdef WIN32
-    WSADATA wsa;
-    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+    size_t read_count = 0;
+    for (MODBUS_READ_OPERATION * operation = config->p_operation; operation; operation = operation->p_next)
     {
-        LogError("Failed. Error Code : %d", WSAGetLastError());
-        return INVALID_SOCKET;
+        read_count++;
+        for (MODBUS_READ_OPERATION * segment = operation->p_segment; segment; segment = segment->p_next)
+            read_count++;
     }
-#endif
-
-    while (server_config)
+    return read_count;
+}
+static size_t get_cell_count(MODBUS_READ_CONFIG * config)
+{
+    size_t cell_count = 0;
+    for (MODBUS_READ_OPERATION * operation = config->p_operation; operation; operation = operation->p_next)
     {
-        server_config->files = INVALID_FILE;
-        server_config->socks = INVALID_SOCKET;
-        //connect to server
-
-        int connection_type = getServerType(server_config->server_str);
-        
-        if (connection_type == CONNECTION_COM)
-        {
-            server_config->encode_read_cb = (encode_read_cb_type)encode_read_request_com;
-            server_config->encode_write_cb = (encode_write_cb_type)encode_write_request_com;
-            server_config->decode_response_cb = (decode_response_cb_type)decode_response_com;
-            server_config->send_request_cb = (send_request_cb_type)send_request_com;
-            server_config->close_server_cb = (close_server_cb_type)close_server_com;
-            set_com_state(server_config);
-        }
-        else if(connection_type == CONNECTION_TCP)
+        if (operation->p_segment == NULL)
         {
-            server_config->encode_read_cb = (encode_read_cb_type)encode_read_request_tcp;
-            server_config->encode_write_cb = (encode_write_cb_type)encode_write_request_tcp;
-            server_config->decode_response_cb = (decode_response_cb_type)decode_response_tcp;
-            server_config->send_request_cb = (send_request_cb_type)send_request_tcp;
-            server_config->close_server_cb = (close_server_cb_type)close_server_tcp;
+            cell_count += operation->length;
         }
-
-        connect_modbus_server(server_config);
-        
-        MODBUS_READ_OPERATION * request_operation = server_config->p_operation;
-        while (request_operation)
+        else
         {
-            if (server_config->encode_read_cb)
-                server_config->encode_read_cb(request_operation->read_request, &(request_operation->read_request_len), request_operation);
-            request_operation = request_operation->p_next;
+            for (MODBUS_READ_OPERATION * segment = operation->p_segment; segment; segment = segment->p_next)
+                cell_count += segment->length;
         }
-        //check mac
-        server_config = server_config->p_next;
-    }
-
-    MAP_HANDLE propertiesMap = Map_Create(NULL);
-    MAP_HANDLE sqlite_propertiesMap = Map_Create(NULL);
-    if(sqlite_propertiesMap == NULL || propertiesMap == NULL)
-    {
-        LogError("unable to create a Map");
     }
-    else
+    return cell_count;
+}
+static size_t write_json_string(char * out, const char * text)
+{
+    size_t len = 0;
+    out[len++] = '"';
+    for (; *text; text++)
     {
-        if (Map_AddOrUpdate(propertiesMap, "modbusRead", "from Azure IoT Gateway SDK simple sample!") != MAP_OK )
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\')
         {
-            LogError("Could not attach modbusRead property to message");
-        } 
-        else if (Map_AddOrUpdate(propertiesMap, "source", "modbus") != MAP_OK)
-        {
-            LogError("Could not attach source property to message");
+            out[len++] = '\\';
+            out[len++] = c;
         }
-        else if (Map_AddOrUpdate(sqlite_propertiesMap, "sqlite", "modbus") != MAP_OK)
+        else if (c < 0x20)
         {
-            LogError("Could not attach sqlite property to message");
+            len += SNPRINTF_S(out + len, 7, "\\u%04x", c);
         }
         else
         {
-            msgConfig.sourceProperties = propertiesMap;
-            sqlite_msgConfig.sourceProperties = sqlite_propertiesMap;
-            while (1)
-            {
-                if (Lock(handleData->lockHandle) == LOCK_OK)
-                {
-                    if (handleData->stopThread)
-                    {
-                        Map_Destroy(propertiesMap);
-                        Map_Destroy(sqlite_propertiesMap);
-                        (void)Unlock(handleData->lockHandle);
-                        break; /*gets out of the thread*/
-                    }
-                    else
-                    {
-                        server_config = handleData->config;
-                        while (server_config)
-                        {
-                            if ((server_config->time_check) * 1000 >= server_config->read_interval)
-                            {
-                                server_config->time_check = 0;
-                                if (process_operation(server_config, server_config->p_operation) != 0)
-                                {
-                                    LogError("unable to send request to modbus server %s", server_config->server_str);
-                                    connect_modbus_server(server_config);
-                                }
-                                else
-                                {
-                                    if (Map_AddOrUpdate(propertiesMap, "macAddress", (const char *)server_config->mac_address) != MAP_OK)
-                                    {
-                                        LogError("Could not attach macAddress property to message");
-                                    }
-                                    else
-                                    {
-                                        if (server_config->sqlite_enabled)
-                                        {
-                                            modbus_publish(handleData->broker, (MODULE_HANDLE *)param, &sqlite_msgConfig, server_config->sqlite_enabled);
-                                        }
-                                        modbus_publish(handleData->broker, (MODULE_HANDLE *)param, &msgConfig, 0);
-                                    }
-                                }
-                            }
-                            else
-                            {
-                                server_config->time_check++;
-                            }
-
-                            server_config = server_config->p_next;
-                        }
-                        (void)Unlock(handleData->lockHandle);
-                    }
-                }
-                else
-                {
-                    /*shall retry*/
-                }
-                (void)ThreadAPI_Sleep(1000);
-            }
+            out[len++] = c;
         }
     }
-    return 0;
+    out[len++] = '"';
+    return len;
 }
-static void ModbusRead_Start(MODULE_HANDLE module)
+//one reusable buffer per server holds the compact telemetry message, it is sized for every cell of the server so encoding never allocates
+static void create_telemetry_buffer(MODBUS_READ_CONFIG * config)
 {
-    MODBUSREAD_HANDLE_DATA* handleData = module;
-    if (handleData != NULL)
+    //every character may need a \u00XX escape
+    size_t prefix_size = sizeof("{\"mac_address\":\"\",\"device_type\":\"\"") + 6 * (sizeof(config->mac_address) + sizeof(config->device_type));
+
+    config->telemetry_size = prefix_size + sizeof(TELEMETRY_TIMESTAMP_KEY) + TIMESTRLEN + get_cell_count(config) * TELEMETRY_CELL_MAX_LEN + 3;
+    config->telemetry = malloc(config->telemetry_size);
+    if (config->telemetry == NULL)
     {
-        if (Lock(handleData->lockHandle) != LOCK_OK)
+        LogError("unable to malloc the telemetry buffer of %s, telemetry is not published", config->server_str);
+        return;
+    }
+
+    config->telemetry_len = 0;
+    write_telemetry(config, "{\"mac_address\":", 15);
+    config->telemetry_len += write_json_string(config->telemetry + config->telemetry_len, config->mac_address);
+    write_telemetry(config, ",\"device_type\":", 15);
+    config->telemetry_len += write_json_string(config->telemetry + config->telemetry_len, config->device_type);
+    config->telemetry_prefix_len = config->telemetry_len;
+}
+//the stats message is encoded into a buffer allocated once, only when the server publishes stats
+static void create_stats_buffer(MODBUS_READ_CONFIG * config)
+{
+    if (config->stats_interval == 0)
+        return;
+    config->stats_size = STATS_MESSAGE_BASE_LEN + get_read_count(config) * STATS_OPERATION_MAX_LEN;
+    config->stats_message = malloc(config->stats_size);
+    if (config->stats_message == NULL)
+    {
+        LogError("unable to malloc the stats message of %s, stats are not published", config->server_str);
+    }
+}
+//report by exception keeps the last reported value of every cell of the configured operations
+static void create_value_caches(MODBUS_READ_CONFIG * config)
+{
+    for (MODBUS_READ_OPERATION * operation = config->p_operation; operation; operation = operation->p_next)
+    {
+        if (operation->p_segment == NULL)
         {
-            LogError("not able to Lock, still setting the thread to finish");
-            handleData->stopThread = 1;
+            create_value_cache(config, operation);
         }
         else
         {
-            if (ThreadAPI_Create(&handleData->threadHandle, modbusReadThread, handleData) != THREADAPI_OK)
-            {
-                LogError("failed to spawn a thread");
-                handleData->threadHandle = NULL;
-            }
-            (void)Unlock(handleData->lockHandle);
+            for (MODBUS_READ_OPERATION * segment = operation->p_segment; segment; segment = segment->p_next)
+                create_value_cache(config, segment);
         }
     }
 }
-
-static MODULE_HANDLE ModbusRead_Create(BROKER_HANDLE broker, const void* configuration)
+static unsigned int hash_phase_seed(unsigned int seed)
 {
-    bool isValidConfig = true;
-    MODBUSREAD_HANDLE_DATA* result = NULL;
-    if (
-        (broker == NULL || configuration == NULL)
-        )
+    //murmur3 finalizer, neighbouring seeds land far apart
+    seed ^= seed >> 16;
+    seed *= 0x85ebca6b;
+    seed ^= seed >> 13;
+    seed *= 0xc2b2ae35;
+    seed ^= seed >> 16;
+    return seed;
+}
+//server k of n starts its intervals at phase (k + seed fraction) / n, so the first deadlines of the servers are spread evenly instead of firing together
+static uint64_t get_first_deadline(MODBUS_READ_CONFIG * server_config, size_t server_i, size_t server_count, size_t read_interval)
+{
+    uint64_t phase = ((uint64_t)server_i * 65536 + (hash_phase_seed(server_config->phase_seed) & 0xFFFF)) / server_count;
+    return (uint64_t)read_interval * phase / 65536;
+}
+static MODBUS_READ_CONFIG * get_shard_server(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config)
+{
+    while (server_config && (size_t)server_config->shard != shard->index)
+        server_config = server_config->p_next;
+    return server_config;
+}
+//builds the min-heap of read operations of the servers of a shard ordered by their next due time
+static int create_schedule(POLL_SHARD * shard, uint64_t now)
+{
+    size_t count = 0;
+    size_t server_count = 0;
+    size_t server_i = 0;
+    for (MODBUS_READ_CONFIG * server_config = get_shard_server(shard, shard->module->config); server_config; server_config = get_shard_server(shard, server_config->p_next))
     {
-
-        /*Codes_SRS_MODBUS_READ_99_001: [If broker is NULL then ModbusRead_Create shall fail and return NULL.]*/
-        /*Codes_SRS_MODBUS_READ_99_002 : [If configuration is NULL then ModbusRead_Create shall fail and return NULL.]*/
-        LogError("invalid arg broker=%p configuration=%p", broker, configuration);
+        //room for the segments of merged reads that get read apart
+        count += get_read_count(server_config);
+        server_count++;
     }
-    else
-    {
-        /* validate mac_address, server_str*/
 
-        MODBUS_READ_CONFIG *cur_config = (MODBUS_READ_CONFIG *)configuration;
+    shard->schedule_count = 0;
+    shard->schedule = malloc((count > 0 ? count : 1) * sizeof(SCHEDULE_ENTRY));
+    if (shard->schedule == NULL)
+    {
+        LogError("unable to malloc the poll schedule");
+        return 1;
+    }
 
-        result = malloc(sizeof(MODBUSREAD_HANDLE_DATA));
-        if (result == NULL)
-        {
-            /*Codes_SRS_MODBUS_READ_99_007: [If ModbusRead_Create encounters any errors while creating the MODBUSREAD_HANDLE_DATA then it shall fail and return NULL.]*/
-            LogError("unable to malloc");
-        }
-        else
+    for (MODBUS_READ_CONFIG * server_config = get_shard_server(shard, shard->module->config); server_config; server_config = get_shard_server(shard, server_config->p_next))
+    {
+        for (MODBUS_READ_OPERATION * operation = server_config->p_operation; operation; operation = operation->p_next)
         {
-            result->lockHandle = Lock_Init();
-            if (result->lockHandle == NULL)
-            {
-                LogError("unable to Lock_Init");
-                free(result);
-                result = NULL;
-            }
-            else
-            {
-                result->stopThread = 0;
-                result->broker = broker;
-                result->config = (MODBUS_READ_CONFIG *)configuration;
-                result->threadHandle = NULL;
-            }
+            modbus_schedule_add(shard->schedule, &shard->schedule_count, now + get_first_deadline(server_config, server_i, server_count, operation->read_interval), server_config, operation);
         }
+        server_i++;
     }
-    return result;
+    return 0;
 }
-
-static void ModbusRead_Destroy(MODULE_HANDLE module)
+#ifndef WIN32
+static int watch_modbus_server(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config)
 {
-    /*Codes_SRS_MODBUS_READ_99_014: [If moduleHandle is NULL then ModbusRead_Destroy shall return.]*/
-    if (module != NULL)
+    int fd = is_com_server(server_config) ? server_config->files : server_config->socks;
+    struct epoll_event event;
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0)
     {
-        /*first stop the thread*/
-        MODBUSREAD_HANDLE_DATA* handleData = module;
-        int notUsed;
-        if (Lock(handleData->lockHandle) != LOCK_OK)
-        {
-            LogError("not able to Lock, still setting the thread to finish");
-            handleData->stopThread = 1;
-        }
-        else
-        {
-            handleData->stopThread = 1;
-            Unlock(handleData->lockHandle);
-        }
+        LogError("unable to set modbus server %s non-blocking", server_config->server_str);
+        return 1;
+    }
+    if (shard == NULL || shard->epollHandle == -1)
+        return 0;
 
-        /*Codes_SRS_MODBUS_READ_99_015 : [Otherwise ModbusRead_Destroy shall unuse all used resources.]*/
-        if (ThreadAPI_Join(handleData->threadHandle, &notUsed) != THREADAPI_OK)
+    memset(&event, 0, sizeof(event));
+    event.events = server_config->connecting ? EPOLLOUT : EPOLLIN;
+    event.data.ptr = server_config;
+    if (epoll_ctl(shard->epollHandle, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        LogError("epoll_ctl failed for modbus server %s", server_config->server_str);
+        return 1;
+    }
+    return 0;
+}
+#endif
+static void record_server_success(MODBUS_READ_CONFIG * server_config)
+{
+    if (server_config->breaker_state != BREAKER_CLOSED)
+    {
+        LogInfo("modbus server %s is answering again", server_config->server_str);
+    }
+    server_config->breaker_state = BREAKER_CLOSED;
+    server_config->breaker_failures = 0;
+}
+//opens the breaker after a run of failures, every failed probe doubles the backoff
+static void record_server_failure(MODBUS_READ_CONFIG * server_config)
+{
+    server_config->breaker_failures++;
+    if (server_config->breaker_failures >= BREAKER_FAILURE_THRESHOLD)
+    {
+        unsigned int doublings = server_config->breaker_failures - BREAKER_FAILURE_THRESHOLD;
+        uint64_t backoff = (doublings < 16) ? ((uint64_t)BREAKER_BACKOFF_MIN_MS << doublings) : BREAKER_BACKOFF_MAX_MS;
+        if (backoff > BREAKER_BACKOFF_MAX_MS)
+            backoff = BREAKER_BACKOFF_MAX_MS;
+        if (server_config->breaker_state == BREAKER_CLOSED)
         {
-            LogError("unable to ThreadAPI_Join, still proceeding in _Destroy");
+            LogError("modbus server %s failed %u times in a row, polling it again in %u ms", server_config->server_str, server_config->breaker_failures, (unsigned int)backoff);
         }
-
-        (void)Lock_Deinit(handleData->lockHandle);
-        modbus_cleanup(handleData->config);
-        free(handleData);
+        server_config->breaker_state = BREAKER_OPEN;
+        server_config->breaker_retry_time = get_monotonic_ms() + backoff;
     }
 }
-//remote command format {"functionCode":"6","startingAddress":"1","value":"100","uid":"1"}
-static void ModbusRead_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
+//an open breaker turns half-open once its backoff ran out, letting one cycle probe the server
+static bool is_breaker_open(MODBUS_READ_CONFIG * server_config, uint64_t now)
 {
-    if (moduleHandle == NULL || messageHandle == NULL)
+    if (server_config->breaker_state == BREAKER_OPEN && now >= server_config->breaker_retry_time)
     {
-        /*Codes_SRS_MODBUS_READ_99_009: [If moduleHandle is NULL then ModbusRead_Receive shall fail and return.]*/
-        /*Codes_SRS_MODBUS_READ_99_010 : [If messageHandle is NULL then ModbusRead_Receive shall fail and return.]*/
-        LogError("Received NULL arguments: module = %p, massage = %p", moduleHandle, messageHandle);
+        server_config->breaker_state = BREAKER_HALF_OPEN;
     }
-    else
-    {
+    return server_config->breaker_state == BREAKER_OPEN;
+}
+//a unit that stops answering leaves a shared serial line usable for the others
+static void drop_server_connection(MODBUS_READ_CONFIG * server_config)
+{
+    //a port shared with other servers stays open after timeouts and exceptions, a failed read or write closes it for all of them
+    if (server_config->bus != NULL && server_config->bus->member_count > 1)
+    {
+        if (!server_config->io_failed)
+            return;
+        server_config->files = server_config->bus->files;
+    }
+    server_config->io_failed = 0;
+    server_config->connecting = 0;
+    if (server_config->close_server_cb)
+        server_config->close_server_cb(server_config);
+}
+static int connect_modbus_server(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config)
+{
+    //a closed descriptor is dropped from the epoll set by the kernel
+    server_config->connecting = 0;
+    server_config->rx_len = 0;
+    server_config->io_failed = 0;
+    server_config->connect_start_us = get_monotonic_us();
+    if (server_config->close_server_cb)
+        server_config->close_server_cb(server_config);
+
+    if (is_com_server(server_config))
+    {
+        server_config->frame_gap_us = get_frame_gap_us(server_config);
+        if (server_config->bus != NULL && server_config->bus->files != INVALID_FILE)
+        {
+            //another server on the line has opened the port already
+            server_config->files = server_config->bus->files;
+            return 0;
+        }
+        server_config->files = connect_modbus_server_com(atoi(server_config->server_str + 3));
+        if (server_config->files == INVALID_FILE)
+        {
+            server_config->stats.connect_failures++;
+            record_server_failure(server_config);
+            return 1;
+        }
+        set_com_state(server_config);
+        if (server_config->bus != NULL)
+            server_config->bus->files = server_config->files;
+    }
+    else
+    {
+        server_config->socks = connect_modbus_server_tcp(server_config->server_str, server_config->response_timeout_max, &server_config->connecting);
+
+        if (server_config->socks == INVALID_SOCKET)
+        {
+            server_config->stats.connect_failures++;
+            record_server_failure(server_config);
+            return 1;
+        }
+        server_config->connect_deadline = get_monotonic_ms() + server_config->connect_timeout;
+    }
+    if (!server_config->connecting)
+        record_latency(server_config, MODBUS_PHASE_CONNECT, server_config->connect_start_us);
+#ifndef WIN32
+    return watch_modbus_server(shard, server_config);
+#else
+    (void)shard;
+    return 0;
+#endif
+}
+static void publish_sqlite(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, MESSAGE_CONFIG * sqlite_msgConfig)
+{
+    //the buffer always has room left for the suffix
+    memcpy(server_config->sqlite_upsert + server_config->sqlite_len, SQLITE_COMMAND_SUFFIX, sizeof(SQLITE_COMMAND_SUFFIX));
+    modbus_publish(shard->module->broker, (MODULE_HANDLE *)shard->module, sqlite_msgConfig, server_config->sqlite_upsert, server_config->sqlite_len + sizeof(SQLITE_COMMAND_SUFFIX) - 1);
+}
+static void publish_server(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, MESSAGE_CONFIG * msgConfig, MESSAGE_CONFIG * sqlite_msgConfig)
+{
+    if (Map_AddOrUpdate(msgConfig->sourceProperties, "macAddress", (const char *)server_config->mac_address) != MAP_OK)
+    {
+        LogError("Could not attach macAddress property to message");
+    }
+    else
+    {
+        if (server_config->sqlite_enabled)
+        {
+            publish_sqlite(shard, server_config, sqlite_msgConfig);
+        }
+        modbus_publish(shard->module->broker, (MODULE_HANDLE *)shard->module, msgConfig, server_config->telemetry, server_config->telemetry_len);
+    }
+}
+static bool append_stats(MODBUS_READ_CONFIG * server_config, size_t * len, int written)
+{
+    if (written <= 0 || (size_t)written >= server_config->stats_size - *len)
+        return false;
+    *len += written;
+    return true;
+}
+//counters and latency summaries (in us) of the server, then the counters of each read it sends, returns the message length or 0 if it does not fit
+static size_t encode_stats(MODBUS_READ_CONFIG * server_config, uint64_t interval)
+{
+    static const char * phase_names[MODBUS_PHASE_COUNT] = { "connect", "send", "wait", "decode", "publish" };
+    MODBUS_READ_STATS * stats = &server_config->stats;
+    char * out = server_config->stats_message;
+    size_t len = 0;
+    bool encoded = append_stats(server_config, &len, SNPRINTF_S(out, server_config->stats_size,
+        "{\"mac_address\":\"%s\",\"server\":\"%s\",\"interval\":\"%u\",\"requests\":\"%u\",\"responses\":\"%u\",\"timeouts\":\"%u\",\"exceptions\":\"%u\",\"reconnects\":\"%u\",\"connectFailures\":\"%u\",\"bytesOut\":\"%llu\",\"bytesIn\":\"%llu\",\"latency\":{",
+        server_config->mac_address, server_config->server_str, (unsigned int)interval, stats->requests, stats->responses, stats->timeouts, stats->exceptions, stats->reconnects, stats->connect_failures,
+        (unsigned long long)stats->bytes_out, (unsigned long long)stats->bytes_in));
+
+    for (int phase = 0; encoded && phase < MODBUS_PHASE_COUNT; phase++)
+    {
+        MODBUS_LATENCY_HISTOGRAM * histogram = &stats->latency[phase];
+        encoded = append_stats(server_config, &len, SNPRINTF_S(out + len, server_config->stats_size - len,
+            "%s\"%s\":{\"count\":\"%u\",\"mean\":\"%u\",\"p50\":\"%u\",\"p90\":\"%u\",\"p99\":\"%u\",\"max\":\"%u\"}",
+            (phase == 0) ? "" : ",", phase_names[phase], histogram->count, (histogram->count > 0) ? (unsigned int)(histogram->sum_us / histogram->count) : 0,
+            modbus_histogram_percentile(histogram, 50), modbus_histogram_percentile(histogram, 90), modbus_histogram_percentile(histogram, 99), histogram->max_us));
+    }
+    encoded = encoded && append_stats(server_config, &len, SNPRINTF_S(out + len, server_config->stats_size - len, "},\"operations\":["));
+    for (MODBUS_READ_OPERATION * operation = server_config->p_operation; encoded && operation; operation = operation->p_next)
+    {
+        encoded = append_stats(server_config, &len, SNPRINTF_S(out + len, server_config->stats_size - len,
+            "%s{\"uid\":\"%u\",\"functionCode\":\"%u\",\"startingAddress\":\"%u\",\"length\":\"%u\",\"requests\":\"%u\",\"timeouts\":\"%u\",\"exceptions\":\"%u\"}",
+            (operation == server_config->p_operation) ? "" : ",", operation->unit_id, operation->function_code, operation->address, operation->length,
+            operation->request_count, operation->timeout_count, operation->exception_count));
+    }
+    encoded = encoded && append_stats(server_config, &len, SNPRINTF_S(out + len, server_config->stats_size - len, "]}"));
+    return encoded ? len : 0;
+}
+//publishes what was recorded since the previous stats message and starts over
+static void publish_stats(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, MESSAGE_CONFIG * stats_msgConfig, uint64_t now)
+{
+    size_t stats_len = encode_stats(server_config, now + server_config->stats_interval - server_config->stats_time);
+
+    if (stats_len == 0)
+    {
+        LogError("unable to encode the stats of %s", server_config->server_str);
+    }
+    else if (Map_AddOrUpdate(stats_msgConfig->sourceProperties, "macAddress", (const char *)server_config->mac_address) != MAP_OK)
+    {
+        LogError("Could not attach macAddress property to message");
+    }
+    else
+    {
+        modbus_publish(shard->module->broker, (MODULE_HANDLE *)shard->module, stats_msgConfig, server_config->stats_message, stats_len);
+    }
+
+    memset(&server_config->stats, 0, sizeof(server_config->stats));
+    for (MODBUS_READ_OPERATION * operation = server_config->p_operation; operation; operation = operation->p_next)
+    {
+        operation->request_count = 0;
+        operation->timeout_count = 0;
+        operation->exception_count = 0;
+    }
+    server_config->stats_time = now + server_config->stats_interval;
+}
+static MODBUS_READ_OPERATION * get_cycle_operation(MODBUS_READ_OPERATION * operation)
+{
+    while (operation && !operation->in_cycle)
+        operation = operation->p_next;
+    return operation;
+}
+//a cycle is late once its fastest operation falls due again
+static uint64_t get_cycle_deadline(MODBUS_READ_CONFIG * server_config)
+{
+    size_t read_interval = SIZE_MAX;
+    MODBUS_READ_OPERATION * operation = get_cycle_operation(server_config->p_operation);
+    while (operation)
+    {
+        if (operation->read_interval < read_interval)
+            read_interval = operation->read_interval;
+        operation = get_cycle_operation(operation->p_next);
+    }
+    return get_monotonic_ms() + read_interval;
+}
+//a server is polled unless its breaker is open, a connect still in progress is waited for by the cycle
+static bool open_server_connection(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, uint64_t now)
+{
+    if (is_breaker_open(server_config, now))
+        return false;
+    if (is_server_connected(server_config) || server_config->connecting)
+        return true;
+    server_config->stats.reconnects++;
+    if (connect_modbus_server(shard, server_config) != 0)
+    {
+        LogError("unable to connect to modbus server %s", server_config->server_str);
+        return false;
+    }
+    return true;
+}
+//a cycle reads the operations that are due when it starts, operations falling due meanwhile wait for the next one
+static void start_cycle(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, uint64_t now)
+{
+    bool connected = open_server_connection(shard, server_config, now);
+    MODBUS_READ_OPERATION * operation = server_config->p_operation;
+
+    while (operation)
+    {
+        operation->in_cycle = connected && operation->due;
+        operation->due = 0;
+        operation = operation->p_next;
+    }
+    server_config->due_count = 0;
+
+    if (connected)
+    {
+        server_config->cycle_active = 1;
+        server_config->cycle_status = 0;
+        server_config->p_pending = get_cycle_operation(server_config->p_operation);
+        server_config->cycle_deadline = get_cycle_deadline(server_config);
+    }
+}
+//replaces the merged reads answered with an exception by the operations they were planned from, which are read at once and then on the schedule of the merged read
+static void read_apart_operations(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config)
+{
+    MODBUS_READ_OPERATION ** link = &server_config->p_operation;
+
+    while (*link)
+    {
+        MODBUS_READ_OPERATION * operation = *link;
+        MODBUS_READ_OPERATION * last_segment = operation->p_segment;
+        size_t entry_i;
+
+        if (!operation->read_apart)
+        {
+            link = &operation->p_next;
+            continue;
+        }
+        LogInfo("reading %s at %u apart, the device rejects the merged read", server_config->server_str, operation->address);
+        for (entry_i = 0; entry_i < shard->schedule_count && shard->schedule[entry_i].operation != operation; entry_i++)
+            ;
+        if (operation->due)
+            server_config->due_count--;
+        for (MODBUS_READ_OPERATION * segment = operation->p_segment; segment; segment = segment->p_next)
+        {
+            segment->due = 1;
+            server_config->due_count++;
+            //the schedule has room for every segment, the first takes over the entry of the merged read
+            if (entry_i < shard->schedule_count && segment == operation->p_segment)
+                shard->schedule[entry_i].operation = segment;
+            else if (entry_i < shard->schedule_count)
+                modbus_schedule_add(shard->schedule, &shard->schedule_count, shard->schedule[entry_i].due_time, server_config, segment);
+            last_segment = segment;
+        }
+        last_segment->p_next = operation->p_next;
+        *link = operation->p_segment;
+        link = &last_segment->p_next;
+        free(operation);
+    }
+}
+static void end_cycle(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, MESSAGE_CONFIG * msgConfig, MESSAGE_CONFIG * sqlite_msgConfig)
+{
+    int process_ret = -1;
+    bool has_changes = false;
+    uint64_t start_us = get_monotonic_us();
+
+    server_config->cycle_active = 0;
+    if (server_config->cycle_status == 0)
+    {
+        process_ret = process_operation(server_config, server_config->p_operation, &has_changes);
+        record_latency(server_config, MODBUS_PHASE_DECODE, start_us);
+    }
+
+    if (process_ret != 0)
+    {
+        LogError("unable to send request to modbus server %s", server_config->server_str);
+        //the next cycle reconnects, unless the breaker holds the server back
+        drop_server_connection(server_config);
+    }
+    else if (has_changes)
+    {
+        start_us = get_monotonic_us();
+        publish_server(shard, server_config, msgConfig, sqlite_msgConfig);
+        record_latency(server_config, MODBUS_PHASE_PUBLISH, start_us);
+    }
+    read_apart_operations(shard, server_config);
+}
+static void release_serial_bus(MODBUS_READ_CONFIG * server_config)
+{
+#ifdef WIN32
+    (void)server_config;
+#else
+    SERIAL_BUS * bus = server_config->bus;
+    if (bus != NULL && bus->owner == server_config)
+    {
+        bus->owner = NULL;
+        //the next request waits for the silence that ends the frame on every station
+        bus->idle_time_us = get_monotonic_us() + server_config->frame_gap_us;
+    }
+#endif
+}
+static void abandon_cycle(MODBUS_READ_CONFIG * server_config)
+{
+    //the connection is unusable, drop the outstanding requests and the rest of the cycle
+    MODBUS_READ_OPERATION * operation = server_config->p_operation;
+    while (operation)
+    {
+        operation->in_flight = 0;
+        operation = operation->p_next;
+    }
+    if (server_config->write_count > 0 && server_config->writes[server_config->write_head].state == WRITE_IN_FLIGHT)
+    {
+        server_config->writes[server_config->write_head].state = WRITE_DONE;
+        server_config->writes[server_config->write_head].result = -1;
+    }
+    server_config->in_flight = 0;
+    server_config->cycle_status = 1;
+    server_config->p_pending = NULL;
+    release_serial_bus(server_config);
+    record_server_failure(server_config);
+}
+static void complete_operation(MODBUS_READ_CONFIG * server_config, MODBUS_READ_OPERATION * operation, int send_ret)
+{
+    if (send_ret == -1)
+    {
+        LogError("send request failed");
+        abandon_cycle(server_config);
+    }
+    else
+    {
+        operation->in_flight = 0;
+        server_config->in_flight--;
+        release_serial_bus(server_config);
+        //an exception response still shows the server is alive
+        record_server_success(server_config);
+        if (send_ret > 0)
+        {
+            LogError("Exception occured, error code : %X\n", send_ret);
+            operation->exception_count++;
+            server_config->stats.exceptions++;
+            if (operation->p_segment != NULL)
+            {
+                //a merged read may cover cells the device does not map, its operations are read apart from the end of the cycle on
+                operation->read_apart = 1;
+            }
+            else
+            {
+                server_config->cycle_status = 1;
+            }
+        }
+    }
+}
+//unit id + function code + byte count + values + crc of a read response
+static int get_expected_response_len(MODBUS_READ_OPERATION * operation)
+{
+    if (operation->function_code == 1 || operation->function_code == 2)
+        return 5 + (operation->length + 7) / 8;
+    return 5 + operation->length * 2;
+}
+//the adaptive timeout plus, on a serial line, the time request and response take on the wire
+static uint64_t get_response_timeout(MODBUS_READ_CONFIG * server_config, int request_len, int response_len)
+{
+    return server_config->response_timeout + (get_line_time_us(server_config, request_len + response_len) + 999) / 1000;
+}
+//RFC 6298: the timeout is the smoothed round trip time plus four times its mean deviation, within the configured bounds
+static void update_response_timeout(MODBUS_READ_CONFIG * server_config, uint64_t rtt_us)
+{
+    //a round trip past the ceiling counts as the ceiling
+    uint64_t rtt_max_us = (uint64_t)server_config->response_timeout_max * 1000;
+    unsigned int rtt = (unsigned int)((rtt_us == 0) ? 1 : ((rtt_us > rtt_max_us) ? rtt_max_us : rtt_us));
+    uint64_t timeout;
+
+    if (server_config->srtt_us == 0)
+    {
+        server_config->srtt_us = rtt;
+        server_config->rttvar_us = rtt / 2;
+    }
+    else
+    {
+        unsigned int deviation = (server_config->srtt_us > rtt) ? server_config->srtt_us - rtt : rtt - server_config->srtt_us;
+        server_config->rttvar_us = (3 * server_config->rttvar_us + deviation) / 4;
+        server_config->srtt_us = (7 * server_config->srtt_us + rtt) / 8;
+    }
+    //the variation term is at least the 1ms clock granularity
+    timeout = ((uint64_t)server_config->srtt_us + ((server_config->rttvar_us > 250) ? 4 * (uint64_t)server_config->rttvar_us : 1000) + 999) / 1000;
+    if (timeout < server_config->response_timeout_min)
+        timeout = server_config->response_timeout_min;
+    if (timeout > server_config->response_timeout_max)
+        timeout = server_config->response_timeout_max;
+    server_config->response_timeout = (size_t)timeout;
+}
+//counts the requests whose response is overdue, the cycle they belong to is abandoned
+static void record_timeouts(MODBUS_READ_CONFIG * server_config, uint64_t now)
+{
+    MODBUS_READ_OPERATION * operation = server_config->p_operation;
+
+    server_config->stats.timeouts++;
+    while (operation)
+    {
+        if (operation->in_flight && now >= operation->response_deadline)
+            operation->timeout_count++;
+        operation = operation->p_next;
+    }
+}
+//a timed out request gives no sample (Karn), the timeout doubles until a response is timed again
+static void back_off_response_timeout(MODBUS_READ_CONFIG * server_config)
+{
+    server_config->response_timeout *= 2;
+    if (server_config->response_timeout > server_config->response_timeout_max)
+        server_config->response_timeout = server_config->response_timeout_max;
+}
+#ifndef WIN32
+//a response came in: feeds the adaptive timeout and the wait latency
+static void sample_round_trip(MODBUS_READ_CONFIG * server_config, uint64_t sent_time_us, int request_len, int response_len)
+{
+    uint64_t rtt_us = get_monotonic_us() - sent_time_us;
+    //on a serial line the frames' own transmission time is not part of the device's latency
+    uint64_t line_time_us = get_line_time_us(server_config, request_len + response_len);
+
+    server_config->stats.responses++;
+    server_config->stats.bytes_in += response_len;
+    modbus_histogram_record(&server_config->stats.latency[MODBUS_PHASE_WAIT], rtt_us);
+    update_response_timeout(server_config, (rtt_us > line_time_us) ? rtt_us - line_time_us : 0);
+}
+#endif
+static void send_operation(MODBUS_READ_CONFIG * server_config, uint64_t now)
+{
+    MODBUS_READ_OPERATION * operation = server_config->p_pending;
+    server_config->p_pending = get_cycle_operation(operation->p_next);
+    operation->in_flight = 1;
+    server_config->in_flight++;
+    operation->request_count++;
+    server_config->stats.requests++;
+#ifdef WIN32
+    int send_ret = -1;
+    (void)now;
+    if (server_config->send_request_cb)
+        send_ret = server_config->send_request_cb(server_config, operation->read_request, operation->read_request_len, operation->response);
+    complete_operation(server_config, operation, send_ret);
+#else
+    if (!is_com_server(server_config))
+    {
+        operation->transaction_id = ++server_config->transaction_id;
+        set_transaction_id(operation->read_request, operation->transaction_id);
+    }
+    operation->sent_time_us = get_monotonic_us();
+    operation->response_deadline = now + get_response_timeout(server_config, operation->read_request_len, get_expected_response_len(operation));
+    if (server_config->write_request_cb == NULL ||
+        server_config->write_request_cb(server_config, operation->read_request, operation->read_request_len) != 0)
+    {
+        complete_operation(server_config, operation, -1);
+    }
+    else
+    {
+        server_config->stats.bytes_out += operation->read_request_len;
+        record_latency(server_config, MODBUS_PHASE_SEND, operation->sent_time_us);
+    }
+#endif
+}
+static MODBUS_WRITE * get_head_write(MODBUS_READ_CONFIG * server_config, int state)
+{
+    MODBUS_WRITE * modbus_write = (server_config->write_count > 0) ? &server_config->writes[server_config->write_head] : NULL;
+    return (modbus_write != NULL && modbus_write->state == state) ? modbus_write : NULL;
+}
+static void complete_write(MODBUS_READ_CONFIG * server_config, MODBUS_WRITE * modbus_write, int send_ret)
+{
+    if (send_ret == -1)
+    {
+        LogError("send write request failed");
+        abandon_cycle(server_config);
+    }
+    else
+    {
+        modbus_write->state = WRITE_DONE;
+        modbus_write->result = send_ret;
+        server_config->in_flight--;
+        release_serial_bus(server_config);
+        record_server_success(server_config);
+        if (send_ret > 0)
+            server_config->stats.exceptions++;
+    }
+}
+static void send_write(MODBUS_READ_CONFIG * server_config, MODBUS_WRITE * modbus_write, uint64_t now)
+{
+    modbus_write->state = WRITE_IN_FLIGHT;
+    server_config->in_flight++;
+    server_config->stats.requests++;
+#ifdef WIN32
+    unsigned char response[256];
+    int send_ret = -1;
+    (void)now;
+    if (server_config->send_request_cb)
+        send_ret = server_config->send_request_cb(server_config, modbus_write->request, modbus_write->request_len, response);
+    complete_write(server_config, modbus_write, send_ret);
+#else
+    if (!is_com_server(server_config))
+    {
+        modbus_write->transaction_id = ++server_config->transaction_id;
+        set_transaction_id(modbus_write->request, modbus_write->transaction_id);
+    }
+    modbus_write->sent_time_us = get_monotonic_us();
+    //every write is answered by an 8 byte echo on a serial line
+    modbus_write->response_deadline = now + get_response_timeout(server_config, modbus_write->request_len, 8);
+    if (server_config->write_request_cb == NULL ||
+        server_config->write_request_cb(server_config, modbus_write->request, modbus_write->request_len) != 0)
+    {
+        complete_write(server_config, modbus_write, -1);
+    }
+    else
+    {
+        server_config->stats.bytes_out += modbus_write->request_len;
+        record_latency(server_config, MODBUS_PHASE_SEND, modbus_write->sent_time_us);
+    }
+#endif
+}
+static void publish_write_result(MODBUSREAD_HANDLE_DATA * handleData, MODBUS_READ_CONFIG * server_config, MODBUS_WRITE * modbus_write, MESSAGE_CONFIG * write_msgConfig)
+{
+    char result[WRITE_RESULT_LEN];
+    const char * status = (modbus_write->result == 0) ? "ok" : ((modbus_write->result > 0) ? "exception" : "failed");
+    char values[16];
+
+    //a single write echoes its value, a batch its size
+    if (modbus_write->count == 1)
+        (void)SNPRINTF_S(values, sizeof(values), "\"value\":\"%u\"", modbus_write_is_coil(modbus_write->function_code) ? (modbus_write->data[0] & 1) : ((modbus_write->data[0] << 8) | modbus_write->data[1]));
+    else
+        (void)SNPRINTF_S(values, sizeof(values), "\"count\":\"%u\"", modbus_write->count);
+
+    int result_len = SNPRINTF_S(result, sizeof(result), "{\"mac_address\":\"%s\",\"uid\":\"%u\",\"functionCode\":\"%u\",\"startingAddress\":\"%u\",%s,\"result\":\"%s\",\"exceptionCode\":\"%d\"}",
+        server_config->mac_address, modbus_write->uid, modbus_write->function_code, modbus_write->address, values, status, (modbus_write->result > 0) ? modbus_write->result : 0);
+
+    if (result_len <= 0 || result_len >= (int)sizeof(result))
+    {
+        LogError("unable to encode the write result of %s", server_config->server_str);
+    }
+    else if (Map_AddOrUpdate(write_msgConfig->sourceProperties, "macAddress", (const char *)server_config->mac_address) != MAP_OK)
+    {
+        LogError("Could not attach macAddress property to message");
+    }
+    else
+    {
+        modbus_publish(handleData->broker, (MODULE_HANDLE *)handleData, write_msgConfig, result, result_len);
+    }
+}
+static uint64_t get_response_deadline(MODBUS_READ_CONFIG * server_config)
+{
+    uint64_t deadline = UINT64_MAX;
+    MODBUS_READ_OPERATION * operation = server_config->p_operation;
+    while (operation)
+    {
+        if (operation->in_flight && operation->response_deadline < deadline)
+            deadline = operation->response_deadline;
+        operation = operation->p_next;
+    }
+    MODBUS_WRITE * modbus_write = get_head_write(server_config, WRITE_IN_FLIGHT);
+    if (modbus_write != NULL && modbus_write->response_deadline < deadline)
+        deadline = modbus_write->response_deadline;
+#ifndef WIN32
+    //a started RTU frame fails as soon as the line stays silent for too long
+    if (is_com_server(server_config) && server_config->rx_len > 0)
+    {
+        uint64_t frame_deadline = (server_config->rx_time_us + get_frame_silence_us(server_config)) / 1000 + 1;
+        if (frame_deadline < deadline)
+            deadline = frame_deadline;
+    }
+#endif
+    return deadline;
+}
+//a request goes on a shared line once it is idle past the inter-frame gap, earliest cycle deadline first
+static bool acquire_serial_bus(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config)
+{
+#ifdef WIN32
+    //requests complete synchronously on Windows, the line is always idle
+    (void)shard;
+    (void)server_config;
+    return true;
+#else
+    SERIAL_BUS * bus = server_config->bus;
+    if (bus == NULL)
+        return true;
+    if (bus->owner != NULL || get_monotonic_us() < bus->idle_time_us)
+        return false;
+
+    MODBUS_READ_CONFIG * other = get_shard_server(shard, shard->module->config);
+    while (other)
+    {
+        if (other != server_config && other->bus == bus && other->cycle_active && other->p_pending != NULL && other->cycle_deadline < server_config->cycle_deadline)
+            return false;
+        other = get_shard_server(shard, other->p_next);
+    }
+    bus->owner = server_config;
+    return true;
+#endif
+}
+#ifndef WIN32
+//when a server waiting for its serial line shall look again
+static uint64_t get_serial_bus_wake_time(SERIAL_BUS * bus)
+{
+    if (bus->owner != NULL)
+        return get_response_deadline(bus->owner);
+    return bus->idle_time_us / 1000 + 1;
+}
+#endif
+//write-back requests go ahead of the polls, one at a time and in the order they were queued
+static void run_writes(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, uint64_t now)
+{
+    MODBUS_WRITE * modbus_write = get_head_write(server_config, WRITE_QUEUED);
+    if (modbus_write == NULL || server_config->in_flight >= server_config->max_in_flight)
+        return;
+
+    if (!open_server_connection(shard, server_config, now))
+    {
+        //fails right away while the breaker is open
+        modbus_write->state = WRITE_DONE;
+        modbus_write->result = -1;
+    }
+    else if (is_server_connected(server_config) && acquire_serial_bus(shard, server_config))
+    {
+        send_write(server_config, modbus_write, now);
+    }
+}
+static void publish_writes(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, MESSAGE_CONFIG * write_msgConfig)
+{
+    MODBUS_WRITE * modbus_write;
+    while ((modbus_write = get_head_write(server_config, WRITE_DONE)) != NULL)
+    {
+        if (modbus_write->result > 0)
+            LogError("Exception occured, error code : %X\n", modbus_write->result);
+        publish_write_result(shard->module, server_config, modbus_write, write_msgConfig);
+        server_config->write_head = (server_config->write_head + 1) % WRITE_QUEUE_LENGTH;
+        server_config->write_count--;
+        if (modbus_write->result == -1 && !server_config->cycle_active && !server_config->connecting)
+            drop_server_connection(server_config);
+    }
+}
+//advances the server state machine: sends queued writes first, starts a cycle for due operations, keeps up to max_in_flight requests outstanding, enforces the response timeout, publishes the stats when due
+static void run_server(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config, uint64_t now, MESSAGE_CONFIG * msgConfig, MESSAGE_CONFIG * sqlite_msgConfig, MESSAGE_CONFIG * write_msgConfig, MESSAGE_CONFIG * stats_msgConfig)
+{
+    if (server_config->connecting && now >= server_config->connect_deadline)
+    {
+        LogError("connect timeout to modbus server %s", server_config->server_str);
+        server_config->stats.connect_failures++;
+        drop_server_connection(server_config);
+        abandon_cycle(server_config);
+    }
+    if (server_config->in_flight > 0 && now >= get_response_deadline(server_config))
+    {
+        LogError("response timeout from modbus server %s, waited %u ms", server_config->server_str, (unsigned int)server_config->response_timeout);
+        record_timeouts(server_config, now);
+        back_off_response_timeout(server_config);
+        abandon_cycle(server_config);
+    }
+
+    run_writes(shard, server_config, now);
+
+    //a write answered between cycles owns the receive buffer until it completes
+    if (!server_config->cycle_active && server_config->due_count > 0 && server_config->in_flight == 0)
+    {
+        start_cycle(shard, server_config, now);
+    }
+
+    while (server_config->cycle_active && server_config->p_pending != NULL && server_config->in_flight < server_config->max_in_flight &&
+        !server_config->connecting && acquire_serial_bus(shard, server_config))
+    {
+        send_operation(server_config, now);
+    }
+
+    if (server_config->cycle_active && server_config->p_pending == NULL && server_config->in_flight == 0)
+    {
+        end_cycle(shard, server_config, msgConfig, sqlite_msgConfig);
+    }
+
+    publish_writes(shard, server_config, write_msgConfig);
+
+    if (server_config->stats_message != NULL && now >= server_config->stats_time)
+    {
+        publish_stats(shard, server_config, stats_msgConfig, now);
+    }
+}
+#ifndef WIN32
+static MODBUS_READ_OPERATION * get_response_operation(MODBUS_READ_CONFIG * server_config)
+{
+    MODBUS_READ_OPERATION * operation = server_config->p_operation;
+    while (operation)
+    {
+        if (operation->in_flight)
+        {
+            //a serial line has a single outstanding request, tcp responses are matched by transaction id
+            if (is_com_server(server_config) || operation->transaction_id == get_transaction_id(server_config->rx_buf))
+                return operation;
+        }
+        operation = operation->p_next;
+    }
+    return NULL;
+}
+static MODBUS_WRITE * get_response_write(MODBUS_READ_CONFIG * server_config)
+{
+    MODBUS_WRITE * modbus_write = get_head_write(server_config, WRITE_IN_FLIGHT);
+    if (modbus_write != NULL && !is_com_server(server_config) && modbus_write->transaction_id != get_transaction_id(server_config->rx_buf))
+        return NULL;
+    return modbus_write;
+}
+//the background connect of a tcp server completed or failed
+static void on_server_connected(POLL_SHARD * shard, MODBUS_READ_CONFIG * server_config)
+{
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = server_config;
+    server_config->connecting = 0;
+    if (getsockopt(server_config->socks, SOL_SOCKET, SO_ERROR, &error, &error_len) != 0 || error != 0)
+    {
+        LogError("unable to connect to modbus server %s, error %d", server_config->server_str, error);
+        server_config->stats.connect_failures++;
+        drop_server_connection(server_config);
+        abandon_cycle(server_config);
+    }
+    else if (epoll_ctl(shard->epollHandle, EPOLL_CTL_MOD, server_config->socks, &event) != 0)
+    {
+        LogError("epoll_ctl failed for modbus server %s", server_config->server_str);
+        drop_server_connection(server_config);
+        abandon_cycle(server_config);
+    }
+    else
+    {
+        record_latency(server_config, MODBUS_PHASE_CONNECT, server_config->connect_start_us);
+    }
+}
+static void on_server_readable(MODBUS_READ_CONFIG * server_config, uint32_t events)
+{
+    //a shared serial port is watched once, its bytes answer the server that holds the line
+    if (server_config->bus != NULL && server_config->bus->owner != NULL)
+        server_config = server_config->bus->owner;
+
+    //the serial port hung up or failed, an unplugged adapter for instance
+    if (is_com_server(server_config) && (events & (EPOLLHUP | EPOLLERR)) != 0)
+    {
+        LogError("serial port of modbus server %s failed", server_config->server_str);
+        server_config->io_failed = 1;
+        if (server_config->in_flight > 0)
+            abandon_cycle(server_config);
+        drop_server_connection(server_config);
+        return;
+    }
+    server_config->rx_ready = 1;
+    if (server_config->in_flight == 0 && !is_com_server(server_config))
+    {
+        //late responses of timed out requests go through the buffer, which keeps the stream framed
+        int frame_len;
+        while ((frame_len = server_config->read_response_cb(server_config)) > 0)
+            consume_response(server_config, frame_len);
+        if (frame_len < 0 && server_config->close_server_cb)
+            server_config->close_server_cb(server_config);
+        return;
+    }
+    if (server_config->in_flight == 0)
+    {
+        //late response of a timed out request, or the peer went away while idle
+        unsigned char discard[256];
+        int fd = is_com_server(server_config) ? server_config->files : server_config->socks;
+        int read_size = read(fd, discard, sizeof(discard));
+        if (read_size == 0 || (read_size < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            server_config->io_failed = 1;
+            drop_server_connection(server_config);
+        }
+        return;
+    }
+
+    while (server_config->in_flight > 0)
+    {
+        int frame_len = server_config->read_response_cb(server_config);
+        if (frame_len < 0)
+        {
+            LogError("send request failed");
+            abandon_cycle(server_config);
+        }
+        if (frame_len <= 0)
+            break;
+
+        MODBUS_READ_OPERATION * operation = get_response_operation(server_config);
+        MODBUS_WRITE * modbus_write = get_response_write(server_config);
+        int offset = is_com_server(server_config) ? MODBUS_COM_OFFSET : MODBUS_TCP_OFFSET;
+        if (modbus_write != NULL)
+        {
+            sample_round_trip(server_config, modbus_write->sent_time_us, modbus_write->request_len, frame_len);
+            if (server_config->rx_buf[offset] == (modbus_write->request[offset] + 128))
+                complete_write(server_config, modbus_write, server_config->rx_buf[offset + 1]);
+            else
+                complete_write(server_config, modbus_write, 0);
+        }
+        else if (operation == NULL)
+        {
+            LogError("unexpected response from modbus server %s", server_config->server_str);
+        }
+        else
+        {
+            sample_round_trip(server_config, operation->sent_time_us, operation->read_request_len, frame_len);
+            memcpy(operation->response, server_config->rx_buf, frame_len);
+            operation->response_len = frame_len;
+            if (operation->response[offset] == (operation->read_request[offset] + 128))
+                complete_operation(server_config, operation, operation->response[offset + 1]);
+            else
+                complete_operation(server_config, operation, 0);
+        }
+        consume_response(server_config, frame_len);
+    }
+}
+#endif
+static void wait_for_responses(POLL_SHARD * shard, int wait_ms)
+{
+#ifdef WIN32
+    //requests complete synchronously on Windows
+    (void)ThreadAPI_Sleep(wait_ms);
+#else
+    struct epoll_event events[MAX_EVENTS];
+    int event_count = epoll_wait(shard->epollHandle, events, MAX_EVENTS, wait_ms);
+    if (event_count > 0)
+    {
+        if (Lock(shard->lockHandle) == LOCK_OK)
+        {
+            for (int event_i = 0; event_i < event_count; event_i++)
+            {
+                if (events[event_i].data.ptr == NULL)
+                {
+                    //woken by ModbusRead_Receive for a queued write
+                    uint64_t wake_count;
+                    (void)read(shard->wakeHandle, &wake_count, sizeof(wake_count));
+                }
+                else if (((MODBUS_READ_CONFIG *)events[event_i].data.ptr)->connecting)
+                {
+                    on_server_connected(shard, (MODBUS_READ_CONFIG *)events[event_i].data.ptr);
+                }
+                else
+                {
+                    on_server_readable((MODBUS_READ_CONFIG *)events[event_i].data.ptr, events[event_i].events);
+                }
+            }
+            (void)Unlock(shard->lockHandle);
+        }
+    }
+    else if (event_count < 0 && errno != EINTR)
+    {
+        LogError("epoll_wait failed");
+        (void)ThreadAPI_Sleep(wait_ms);
+    }
+#endif
+}
+static bool is_shard_stopping(POLL_SHARD * shard)
+{
+    //shard 0 is stopped by ModbusRead_Destroy through the module lock, the others by shard 0
+    return (shard->index == 0) ? shard->module->stopThread != 0 : shard->stopThread != 0;
+}
+static void set_shard_affinity(POLL_SHARD * shard)
+{
+    if (shard->cpu < 0)
+        return;
+#ifdef WIN32
+    if (SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << shard->cpu) == 0)
+#else
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(shard->cpu, &cpu_set);
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0)
+#endif
+    {
+        LogError("unable to pin poll worker %u to cpu %d", (unsigned int)shard->index, shard->cpu);
+    }
+}
+static int run_shard(POLL_SHARD * shard)
+{
+    MESSAGE_CONFIG msgConfig;
+    MESSAGE_CONFIG sqlite_msgConfig;
+    MESSAGE_CONFIG write_msgConfig;
+    MESSAGE_CONFIG stats_msgConfig;
+    MODBUS_READ_CONFIG * server_config;
+
+    set_shard_affinity(shard);
+#ifndef WIN32
+    shard->epollHandle = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->epollHandle == -1)
+    {
+        LogError("epoll_create1 failed");
+        return -1;
+    }
+    if (shard->wakeHandle != -1)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if (epoll_ctl(shard->epollHandle, EPOLL_CTL_ADD, shard->wakeHandle, &event) != 0)
+        {
+            LogError("epoll_ctl failed for the write queue of poll worker %u, writes wait for the next poll", (unsigned int)shard->index);
+        }
+    }
+#endif
+
+    //all connects start at once, each server is polled as soon as it is connected
+    uint64_t now = get_monotonic_ms();
+    for (server_config = get_shard_server(shard, shard->module->config); server_config; server_config = get_shard_server(shard, server_config->p_next))
+    {
+        server_config->stats_time = now + server_config->stats_interval;
+        if (connect_modbus_server(shard, server_config) == 0 && server_config->connecting && shard->module->startup_deadline != 0)
+        {
+            server_config->connect_deadline = shard->module->startup_deadline;
+        }
+    }
+
+    if (create_schedule(shard, now) != 0)
+    {
+#ifndef WIN32
+        close(shard->epollHandle);
+        shard->epollHandle = -1;
+#endif
+        return -1;
+    }
+
+    MAP_HANDLE propertiesMap = Map_Create(NULL);
+    MAP_HANDLE sqlite_propertiesMap = Map_Create(NULL);
+    MAP_HANDLE write_propertiesMap = Map_Create(NULL);
+    MAP_HANDLE stats_propertiesMap = Map_Create(NULL);
+    if(sqlite_propertiesMap == NULL || propertiesMap == NULL || write_propertiesMap == NULL || stats_propertiesMap == NULL)
+    {
+        LogError("unable to create a Map");
+    }
+    else
+    {
+        if (Map_AddOrUpdate(propertiesMap, "modbusRead", "from Azure IoT Gateway SDK simple sample!") != MAP_OK )
+        {
+            LogError("Could not attach modbusRead property to message");
+        } 
+        else if (Map_AddOrUpdate(propertiesMap, "source", "modbus") != MAP_OK)
+        {
+            LogError("Could not attach source property to message");
+        }
+        else if (Map_AddOrUpdate(sqlite_propertiesMap, "sqlite", "modbus") != MAP_OK)
+        {
+            LogError("Could not attach sqlite property to message");
+        }
+        else if (Map_AddOrUpdate(write_propertiesMap, "modbusWrite", "result") != MAP_OK ||
+            Map_AddOrUpdate(write_propertiesMap, "source", "modbus") != MAP_OK)
+        {
+            LogError("Could not attach modbusWrite property to message");
+        }
+        else if (Map_AddOrUpdate(stats_propertiesMap, "modbusStats", "server") != MAP_OK ||
+            Map_AddOrUpdate(stats_propertiesMap, "source", "modbus") != MAP_OK)
+        {
+            LogError("Could not attach modbusStats property to message");
+        }
+        else
+        {
+            msgConfig.sourceProperties = propertiesMap;
+            sqlite_msgConfig.sourceProperties = sqlite_propertiesMap;
+            write_msgConfig.sourceProperties = write_propertiesMap;
+            stats_msgConfig.sourceProperties = stats_propertiesMap;
+            while (1)
+            {
+                uint64_t wake_time = get_monotonic_ms() + MAX_WAIT_MS;
+                if (Lock(shard->lockHandle) == LOCK_OK)
+                {
+                    if (is_shard_stopping(shard))
+                    {
+                        Map_Destroy(propertiesMap);
+                        Map_Destroy(sqlite_propertiesMap);
+                        Map_Destroy(write_propertiesMap);
+                        Map_Destroy(stats_propertiesMap);
+#ifndef WIN32
+                        close(shard->epollHandle);
+                        shard->epollHandle = -1;
+#endif
+                        free(shard->schedule);
+                        shard->schedule = NULL;
+                        shard->schedule_count = 0;
+                        (void)Unlock(shard->lockHandle);
+                        break; /*gets out of the thread*/
+                    }
+                    else
+                    {
+                        now = get_monotonic_ms();
+                        modbus_schedule_run(shard->schedule, shard->schedule_count, now);
+                        server_config = get_shard_server(shard, shard->module->config);
+                        while (server_config)
+                        {
+                            run_server(shard, server_config, now, &msgConfig, &sqlite_msgConfig, &write_msgConfig, &stats_msgConfig);
+                            if (server_config->stats_message != NULL && server_config->stats_time < wake_time)
+                                wake_time = server_config->stats_time;
+
+                            if (server_config->connecting)
+                            {
+                                if (server_config->connect_deadline < wake_time)
+                                    wake_time = server_config->connect_deadline;
+                            }
+                            else if (server_config->in_flight > 0)
+                            {
+                                uint64_t deadline = get_response_deadline(server_config);
+                                if (deadline < wake_time)
+                                    wake_time = deadline;
+                            }
+                            else if (!server_config->cycle_active && server_config->due_count > 0)
+                            {
+                                //operations fell due while the previous cycle was running
+                                wake_time = now;
+                            }
+#ifndef WIN32
+                            else if (server_config->bus != NULL &&
+                                ((server_config->cycle_active && server_config->p_pending != NULL) || get_head_write(server_config, WRITE_QUEUED) != NULL))
+                            {
+                                uint64_t bus_time = get_serial_bus_wake_time(server_config->bus);
+                                if (bus_time < wake_time)
+                                    wake_time = bus_time;
+                            }
+#endif
+                            server_config = get_shard_server(shard, server_config->p_next);
+                        }
+                        if (shard->schedule_count > 0 && shard->schedule[0].due_time < wake_time)
+                        {
+                            wake_time = shard->schedule[0].due_time;
+                        }
+                        (void)Unlock(shard->lockHandle);
+                    }
+                }
+                else
+                {
+                    /*shall retry*/
+                }
+                now = get_monotonic_ms();
+                wait_for_responses(shard, (wake_time > now) ? (int)(wake_time - now) : 0);
+            }
+        }
+    }
+    return 0;
+}
+static int pollShardThread(void *param)
+{
+    return run_shard((POLL_SHARD *)param);
+}
+static void move_to_first_shard(MODBUS_READ_CONFIG * config, size_t shard_index)
+{
+    for (MODBUS_READ_CONFIG * server_config = config; server_config; server_config = server_config->p_next)
+    {
+        if ((size_t)server_config->shard == shard_index)
+            server_config->shard = 0;
+    }
+}
+//creates the workers of the poll pool, shard 0 is the calling module thread
+static POLL_SHARD * create_shards(MODBUSREAD_HANDLE_DATA * handleData, size_t shard_count)
+{
+    POLL_SHARD * shards = malloc(shard_count * sizeof(POLL_SHARD));
+    if (shards == NULL)
+    {
+        LogError("unable to malloc the poll workers");
+        return NULL;
+    }
+
+    memset(shards, 0, shard_count * sizeof(POLL_SHARD));
+    for (size_t shard_i = 0; shard_i < shard_count; shard_i++)
+    {
+        POLL_SHARD * shard = &shards[shard_i];
+        shard->module = handleData;
+        shard->index = shard_i;
+        shard->cpu = -1;
+#ifndef WIN32
+        shard->epollHandle = -1;
+        //ModbusRead_Receive wakes the worker through it once a write is queued
+        shard->wakeHandle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->wakeHandle == -1)
+        {
+            LogError("eventfd failed for poll worker %u, writes wait for the next poll", (unsigned int)shard_i);
+        }
+#endif
+        for (MODBUS_READ_CONFIG * server_config = get_shard_server(shard, handleData->config); server_config; server_config = get_shard_server(shard, server_config->p_next))
+        {
+            shard->cpu = server_config->cpu;
+        }
+        shard->lockHandle = (shard_i == 0) ? handleData->lockHandle : Lock_Init();
+        if (shard->lockHandle == NULL)
+        {
+            LogError("unable to Lock_Init, poll worker %u is polled by worker 0", (unsigned int)shard_i);
+            move_to_first_shard(handleData->config, shard_i);
+        }
+    }
+    return shards;
+}
+static void start_shards(POLL_SHARD * shards, size_t shard_count)
+{
+    for (size_t shard_i = 1; shard_i < shard_count; shard_i++)
+    {
+        if (shards[shard_i].lockHandle != NULL &&
+            ThreadAPI_Create(&shards[shard_i].threadHandle, pollShardThread, &shards[shard_i]) != THREADAPI_OK)
+        {
+            LogError("failed to spawn poll worker %u, its servers are polled by worker 0", (unsigned int)shard_i);
+            shards[shard_i].threadHandle = NULL;
+            move_to_first_shard(shards[shard_i].module->config, shard_i);
+        }
+    }
+}
+static void stop_shards(POLL_SHARD * shards, size_t shard_count)
+{
+    for (size_t shard_i = 1; shard_i < shard_count; shard_i++)
+    {
+        POLL_SHARD * shard = &shards[shard_i];
+        if (shard->threadHandle != NULL)
+        {
+            int notUsed;
+            while (Lock(shard->lockHandle) != LOCK_OK)
+            {
+                (void)ThreadAPI_Sleep(100);
+            }
+            shard->stopThread = 1;
+            (void)Unlock(shard->lockHandle);
+            if (ThreadAPI_Join(shard->threadHandle, &notUsed) != THREADAPI_OK)
+            {
+                LogError("unable to ThreadAPI_Join poll worker %u", (unsigned int)shard_i);
+            }
+        }
+        if (shard->lockHandle != NULL)
+        {
+            (void)Lock_Deinit(shard->lockHandle);
+        }
+    }
+}
+//servers on the same port share the bus of the first of them, and are polled by its worker
+static SERIAL_BUS * get_serial_bus(MODBUS_READ_CONFIG * config, MODBUS_READ_CONFIG * server_config)
+{
+    SERIAL_BUS * bus;
+
+    for (MODBUS_READ_CONFIG * other = config; other != server_config; other = other->p_next)
+    {
+        if (other->bus != NULL && strcmp(other->server_str, server_config->server_str) == 0)
+        {
+            server_config->shard = other->shard;
+            server_config->cpu = other->cpu;
+            other->bus->member_count++;
+            return other->bus;
+        }
+    }
+    bus = malloc(sizeof(SERIAL_BUS));
+    if (bus == NULL)
+    {
+        LogError("unable to malloc the serial bus of %s, the port is not shared", server_config->server_str);
+    }
+    else
+    {
+        bus->files = INVALID_FILE;
+        bus->owner = NULL;
+        bus->idle_time_us = 0;
+        bus->member_count = 1;
+    }
+    return bus;
+}
+//the frame codec and transport of the server, returns its connection type
+static int set_server_callbacks(MODBUS_READ_CONFIG * server_config)
+{
+    int connection_type = getServerType(server_config->server_str);
+
+    if (connection_type == CONNECTION_COM)
+    {
+        server_config->encode_read_cb = (encode_read_cb_type)encode_read_request_com;
+        server_config->encode_write_cb = (encode_write_cb_type)encode_write_request_com;
+        server_config->decode_response_cb = (decode_response_cb_type)decode_response_com;
+        server_config->send_request_cb = (send_request_cb_type)send_request_com;
+        server_config->close_server_cb = (close_server_cb_type)close_server_com;
+#ifndef WIN32
+        server_config->write_request_cb = (write_request_cb_type)write_request_com;
+        server_config->read_response_cb = (read_response_cb_type)read_response_com;
+#endif
+    }
+    else if (connection_type == CONNECTION_TCP)
+    {
+        server_config->encode_read_cb = (encode_read_cb_type)encode_read_request_tcp;
+        server_config->encode_write_cb = (encode_write_cb_type)encode_write_request_tcp;
+        server_config->decode_response_cb = (decode_response_cb_type)decode_response_tcp;
+        server_config->send_request_cb = (send_request_cb_type)send_request_tcp;
+        server_config->close_server_cb = (close_server_cb_type)close_server_tcp;
+#ifndef WIN32
+        server_config->write_request_cb = (write_request_cb_type)write_request_tcp;
+        server_config->read_response_cb = (read_response_cb_type)read_response_tcp;
+#endif
+    }
+    return connection_type;
+}
+static int modbusReadThread(void *param)
+{
+    MODBUSREAD_HANDLE_DATA* handleData = param;
+    POLL_SHARD * shards;
+    size_t shard_count = 1;
+    int ret;
+
+    MODBUS_READ_CONFIG * server_config = handleData->config;
+
+#ifdef WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+    {
+        LogError("Failed. Error Code : %d", WSAGetLastError());
+        return INVALID_SOCKET;
+    }
+#endif
+
+    MODBUS_READ_OPERATION * request_operation;
+    while (server_config)
+    {
+        server_config->files = INVALID_FILE;
+        server_config->socks = INVALID_SOCKET;
+        //connect to server
+
+        int connection_type = set_server_callbacks(server_config);
+        
+        if (connection_type == CONNECTION_COM)
+            server_config->bus = get_serial_bus(handleData->config, server_config);
+
+        request_operation = server_config->p_operation;
+        while (request_operation)
+        {
+            if (request_operation->read_interval == 0)
+                request_operation->read_interval = (server_config->read_interval > 0) ? server_config->read_interval : 1;
+            request_operation = request_operation->p_next;
+        }
+        modbus_plan_read_operations(server_config, is_com_server(server_config) ? MODBUS_ROUND_TRIP_COST_COM : MODBUS_ROUND_TRIP_COST_TCP);
+        MODBUS_WRITE * writes = malloc(WRITE_QUEUE_LENGTH * sizeof(MODBUS_WRITE));
+        if (writes == NULL)
+        {
+            LogError("unable to malloc the write queue of %s, write-back is disabled", server_config->server_str);
+        }
+        //ModbusRead_Receive looks at the queue under the module lock
+        while (Lock(handleData->lockHandle) != LOCK_OK)
+        {
+            (void)ThreadAPI_Sleep(100);
+        }
+        server_config->write_head = 0;
+        server_config->write_count = 0;
+        server_config->writes = writes;
+        (void)Unlock(handleData->lockHandle);
+        create_value_caches(server_config);
+        create_telemetry_buffer(server_config);
+        create_stats_buffer(server_config);
+        if (server_config->sqlite_enabled == 1)
+        {
+            server_config->sqlite_upsert = malloc(BUFSIZE);
+            if (server_config->sqlite_upsert == NULL)
+            {
+                LogError("unable to malloc the sqlite command of %s, sqlite is disabled", server_config->server_str);
+                server_config->sqlite_enabled = 0;
+            }
+        }
+        
+        request_operation = server_config->p_operation;
+        while (request_operation)
+        {
+            if (server_config->encode_read_cb)
+            {
+                server_config->encode_read_cb(request_operation->read_request, &(request_operation->read_request_len), request_operation);
+                //the segments of a merged read are ready to be sent on their own
+                for (MODBUS_READ_OPERATION * segment = request_operation->p_segment; segment; segment = segment->p_next)
+                    server_config->encode_read_cb(segment->read_request, &(segment->read_request_len), segment);
+            }
+            request_operation = request_operation->p_next;
+        }
+        if (connection_type != CONNECTION_TCP || server_config->max_in_flight < 1)
+            server_config->max_in_flight = 1;
+        server_config->cycle_active = 0;
+        server_config->in_flight = 0;
+        server_config->due_count = 0;
+        server_config->connecting = 0;
+        server_config->breaker_state = BREAKER_CLOSED;
+        server_config->breaker_failures = 0;
+        server_config->response_timeout = server_config->response_timeout_max;
+        server_config->srtt_us = 0;
+        server_config->rttvar_us = 0;
+        if ((size_t)server_config->shard >= shard_count)
+            shard_count = server_config->shard + 1;
+        //check mac
+        server_config = server_config->p_next;
+    }
+
+    //the workers share one deadline for the connects they start with
+    handleData->startup_deadline = (handleData->startup_timeout > 0) ? get_monotonic_ms() + handleData->startup_timeout : 0;
+    shards = create_shards(handleData, shard_count);
+    if (shards == NULL)
+    {
+        return -1;
+    }
+    //a worker that fails to start hands its servers to worker 0, ModbusRead_Receive finds the workers only once every server has its final one
+    start_shards(shards, shard_count);
+    if (Lock(handleData->lockHandle) == LOCK_OK)
+    {
+        handleData->shards = shards;
+        handleData->shard_count = shard_count;
+        (void)Unlock(handleData->lockHandle);
+    }
+    ret = run_shard(&shards[0]);
+
+    //ModbusRead_Receive stops finding the workers before they are stopped and their locks are deinitialized
+    while (Lock(handleData->lockHandle) != LOCK_OK)
+    {
+        (void)ThreadAPI_Sleep(100);
+    }
+    handleData->shards = NULL;
+    handleData->shard_count = 0;
+    (void)Unlock(handleData->lockHandle);
+
+    stop_shards(shards, shard_count);
+#ifndef WIN32
+    for (size_t shard_i = 0; shard_i < shard_count; shard_i++)
+    {
+        if (shards[shard_i].wakeHandle != -1)
+            close(shards[shard_i].wakeHandle);
+    }
+#endif
+    free(shards);
+    return ret;
+}
+
+static void ModbusRead_Start(MODULE_HANDLE module)
+{
+    MODBUSREAD_HANDLE_DATA* handleData = module;
+    if (handleData != NULL)
+    {
+        if (Lock(handleData->lockHandle) != LOCK_OK)
+        {
+            LogError("not able to Lock, still setting the thread to finish");
+            handleData->stopThread = 1;
+        }
+        else
+        {
+            if (ThreadAPI_Create(&handleData->threadHandle, modbusReadThread, handleData) != THREADAPI_OK)
+            {
+                LogError("failed to spawn a thread");
+                handleData->threadHandle = NULL;
+            }
+            (void)Unlock(handleData->lockHandle);
+        }
+    }
+}
+
+static MODULE_HANDLE ModbusRead_Create(BROKER_HANDLE broker, const void* configuration)
+{
+    bool isValidConfig = true;
+    MODBUSREAD_HANDLE_DATA* result = NULL;
+    if (
+        (broker == NULL || configuration == NULL)
+        )
+    {
+
+        /*Codes_SRS_MODBUS_READ_99_001: [If broker is NULL then ModbusRead_Create shall fail and return NULL.]*/
+        /*Codes_SRS_MODBUS_READ_99_002 : [If configuration is NULL then ModbusRead_Create shall fail and return NULL.]*/
+        LogError("invalid arg broker=%p configuration=%p", broker, configuration);
+    }
+    else
+    {
+        /* validate mac_address, server_str*/
+
+        MODBUS_READ_CONFIG *cur_config = ((MODBUS_READ_MODULE_CONFIG *)configuration)->servers;
+
+        result = malloc(sizeof(MODBUSREAD_HANDLE_DATA));
+        if (result == NULL)
+        {
+            /*Codes_SRS_MODBUS_READ_99_007: [If ModbusRead_Create encounters any errors while creating the MODBUSREAD_HANDLE_DATA then it shall fail and return NULL.]*/
+            LogError("unable to malloc");
+        }
+        else
+        {
+            result->lockHandle = Lock_Init();
+            if (result->lockHandle == NULL)
+            {
+                LogError("unable to Lock_Init");
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                result->stopThread = 0;
+                result->broker = broker;
+                result->config = ((MODBUS_READ_MODULE_CONFIG *)configuration)->servers;
+                result->startup_timeout = ((MODBUS_READ_MODULE_CONFIG *)configuration)->startup_timeout;
+                result->threadHandle = NULL;
+                result->shards = NULL;
+                result->shard_count = 0;
+            }
+        }
+    }
+    return result;
+}
+
+static void ModbusRead_Destroy(MODULE_HANDLE module)
+{
+    /*Codes_SRS_MODBUS_READ_99_014: [If moduleHandle is NULL then ModbusRead_Destroy shall return.]*/
+    if (module != NULL)
+    {
+        /*first stop the thread*/
+        MODBUSREAD_HANDLE_DATA* handleData = module;
+        int notUsed;
+        if (Lock(handleData->lockHandle) != LOCK_OK)
+        {
+            LogError("not able to Lock, still setting the thread to finish");
+            handleData->stopThread = 1;
+        }
+        else
+        {
+            handleData->stopThread = 1;
+            Unlock(handleData->lockHandle);
+        }
+
+        /*Codes_SRS_MODBUS_READ_99_015 : [Otherwise ModbusRead_Destroy shall unuse all used resources.]*/
+        if (ThreadAPI_Join(handleData->threadHandle, &notUsed) != THREADAPI_OK)
+        {
+            LogError("unable to ThreadAPI_Join, still proceeding in _Destroy");
+        }
+
+        (void)Lock_Deinit(handleData->lockHandle);
+        modbus_cleanup(handleData->config);
+        free(handleData);
+    }
+}
+//returns the held lock of the shard polling the server once no read is outstanding on its connection
+//takes the lock of the worker polling the server, the module lock while the workers are not running
+static LOCK_HANDLE lock_modbus_server(MODBUSREAD_HANDLE_DATA * handleData, MODBUS_READ_CONFIG * modbus_config, POLL_SHARD ** shard)
+{
+    LOCK_HANDLE lockHandle = handleData->lockHandle;
+    while (Lock(lockHandle) != LOCK_OK)
+    {
+        (void)ThreadAPI_Sleep(100);
+    }
+    *shard = NULL;
+    if (handleData->shards != NULL && (size_t)modbus_config->shard < handleData->shard_count)
+    {
+        *shard = &handleData->shards[modbus_config->shard];
+        if ((*shard)->index != 0)
+        {
+            //the module lock is released only once the worker lock is held, so the worker cannot be stopped in between
+            lockHandle = (*shard)->lockHandle;
+            while (Lock(lockHandle) != LOCK_OK)
+            {
+                (void)ThreadAPI_Sleep(100);
+            }
+            (void)Unlock(handleData->lockHandle);
+        }
+    }
+    return lockHandle;
+}
+//queues a write-back request for the worker polling the server, fails while the module is not polling yet, when the queue is full or the command is invalid
+//modbus_write receives the parsed request, its count stays 0 when the command is invalid
+static bool queue_write(MODBUS_READ_CONFIG * config, MODBUS_WRITE * modbus_write, unsigned char uid, unsigned char function_code, unsigned short address, const char * value_str)
+{
+    MODBUS_WRITE * target;
+    MODBUS_WRITE queued;
+    bool appended;
+    unsigned short count;
+    bool coils = modbus_write_is_coil(function_code);
+
+    modbus_write->uid = uid;
+    modbus_write->function_code = function_code;
+    modbus_write->address = address;
+    modbus_write->count = 0;
+    if (!coils && function_code != 6 && function_code != 16)
+    {
+        LogError("unsupported write function code %u", function_code);
+        return false;
+    }
+    count = modbus_write_parse_values(value_str, coils, modbus_write->data);
+    if (count == 0 || address == 0 || address - 1 + count > 0x10000)
+    {
+        LogError("invalid write values \"%s\" at address %u", value_str, address);
+        return false;
+    }
+    //several values go out as one FC15/FC16 request
+    modbus_write->function_code = (count > 1) ? (coils ? 15 : 16) : function_code;
+    modbus_write->count = count;
+    modbus_write->state = WRITE_QUEUED;
+    modbus_write->result = 0;
+
+    if (config->writes == NULL || config->encode_write_cb == NULL)
+        return false;
+    //the merged or new entry is built and encoded aside, the queue only changes once its request is ready
+    target = (config->write_count > 0) ? &config->writes[(config->write_head + config->write_count - 1) % WRITE_QUEUE_LENGTH] : NULL;
+    if (target != NULL)
+    {
+        queued = *target;
+        if (!modbus_write_merge(&queued, uid, modbus_write->function_code, address, count, modbus_write->data))
+            target = NULL;
+    }
+    appended = (target == NULL);
+    if (appended)
+    {
+        if (config->write_count == WRITE_QUEUE_LENGTH)
+            return false;
+        target = &config->writes[(config->write_head + config->write_count) % WRITE_QUEUE_LENGTH];
+        queued = *modbus_write;
+    }
+    if (config->encode_write_cb(queued.request, &queued.request_len, &queued) != 0)
+        return false;
+    *target = queued;
+    if (appended)
+        config->write_count++;
+    return true;
+}
+//a write that could not be queued gets the same "failed" result as one the worker could not send
+static void publish_write_failure(MODBUSREAD_HANDLE_DATA * handleData, MODBUS_READ_CONFIG * server_config, MODBUS_WRITE * modbus_write)
+{
+    MESSAGE_CONFIG write_msgConfig;
+    MAP_HANDLE write_propertiesMap = Map_Create(NULL);
+
+    if (write_propertiesMap == NULL)
+    {
+        LogError("unable to create a Map");
+        return;
+    }
+    if (Map_AddOrUpdate(write_propertiesMap, "modbusWrite", "result") != MAP_OK ||
+        Map_AddOrUpdate(write_propertiesMap, "source", "modbus") != MAP_OK)
+    {
+        LogError("Could not attach modbusWrite property to message");
+    }
+    else
+    {
+        modbus_write->result = -1;
+        write_msgConfig.sourceProperties = write_propertiesMap;
+        publish_write_result(handleData, server_config, modbus_write, &write_msgConfig);
+    }
+    Map_Destroy(write_propertiesMap);
+}
+static void wake_shard(POLL_SHARD * shard)
+{
+#ifdef WIN32
+    //the Windows workers look at the queue on their next pass
+    (void)shard;
+#else
+    uint64_t wake_count = 1;
+    if (shard != NULL && shard->wakeHandle != -1 && write(shard->wakeHandle, &wake_count, sizeof(wake_count)) != sizeof(wake_count))
+    {
+        LogError("unable to wake poll worker %u", (unsigned int)shard->index);
+    }
+#endif
+}
+//remote command format {"functionCode":"6","startingAddress":"1","value":"100","uid":"1"}
+static void ModbusRead_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
+{
+    if (moduleHandle == NULL || messageHandle == NULL)
+    {
+        /*Codes_SRS_MODBUS_READ_99_009: [If moduleHandle is NULL then ModbusRead_Receive shall fail and return.]*/
+        /*Codes_SRS_MODBUS_READ_99_010 : [If messageHandle is NULL then ModbusRead_Receive shall fail and return.]*/
+        LogError("Received NULL arguments: module = %p, massage = %p", moduleHandle, messageHandle);
+    }
+    else
+    {
         MODBUSREAD_HANDLE_DATA* handleData = moduleHandle;
         CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
 
@@ -1375,31 +3443,24 @@ static void ModbusRead_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messag
                             {
                                 LogInfo("WriteBack to functionCode: %s, startingAddress: %s, value: %s, uid: %s recived\n", functionCode_str, startingAddress_str, value_str, uid_str);
 
-                                unsigned char request[256];
-                                unsigned char response[256];
-                                int request_len = 0;
+                                POLL_SHARD * shard = NULL;
+                                MODBUS_WRITE modbus_write;
+                                LOCK_HANDLE lockHandle = lock_modbus_server(handleData, modbus_config, &shard);
 
-                                if (modbus_config->encode_write_cb)
-                                    modbus_config->encode_write_cb(request, &request_len, atoi(uid_str), atoi(functionCode_str), atoi(startingAddress_str), atoi(value_str));
-
-                                while (Lock(handleData->lockHandle) != LOCK_OK)
-                                {
-                                    (void)ThreadAPI_Sleep(100);
-                                }
-                                int send_ret = -1;
-
-                                if (modbus_config->send_request_cb)
-                                    send_ret = modbus_config->send_request_cb(modbus_config, request, request_len, response);
-
-                                (void)Unlock(handleData->lockHandle);
-                                if (send_ret == -1)
+                                /*Codes_SRS_MODBUS_READ_99_019: [`ModbusRead_Receive` shall queue the write request to the worker polling the server and return without waiting for its response.]*/
+                                /*Codes_SRS_MODBUS_READ_99_020: [If "value" is a comma separated list, `ModbusRead_Receive` shall queue a single FC15 or FC16 write of the consecutive cells from "startingAddress".]*/
+                                bool queued = queue_write(modbus_config, &modbus_write, (unsigned char)atoi(uid_str), (unsigned char)atoi(functionCode_str), (unsigned short)atoi(startingAddress_str), value_str);
+                                if (queued)
                                 {
-                                    LogError("unable to send request to modbus server");
-                                    connect_modbus_server(modbus_config);
+                                    wake_shard(shard);
                                 }
-                                else if (send_ret > 0)
+                                (void)Unlock(lockHandle);
+                                if (!queued)
                                 {
-                                    LogError("Exception occured, error code : %X\n", send_ret);
+                                    LogError("unable to queue the write request to modbus server %s", modbus_config->server_str);
+                                    /*Codes_SRS_MODBUS_READ_99_021: [If a valid write request cannot be queued, `ModbusRead_Receive` shall publish its "modbusWrite" result as "failed".]*/
+                                    if (modbus_write.count > 0)
+                                        publish_write_failure(handleData, modbus_config, &modbus_write);
                                 }
                             }
                         }
@@ -1420,7 +3481,7 @@ static void ModbusRead_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messag
 static void* ModbusRead_ParseConfigurationFromJson(const char* configuration)
 {
 
-    MODBUS_READ_CONFIG * result = NULL;
+    MODBUS_READ_MODULE_CONFIG * result = NULL;
     /*Codes_SRS_MODBUS_READ_JSON_99_023: [ If configuration is NULL then ModbusRead_CreateFromJson shall fail and return NULL. ]*/
     if (
         (configuration == NULL)
@@ -1440,13 +3501,39 @@ static void* ModbusRead_ParseConfigurationFromJson(const char* configuration)
         {
             /*Codes_SRS_MODBUS_READ_JSON_99_032: [ If the JSON value does not contain `args` array then ModbusRead_CreateFromJson shall fail and return NULL. ]*/
             JSON_Array * arg_array = json_value_get_array(json);
+            JSON_Object * arg_object = NULL;
+            if (arg_array == NULL && (arg_object = json_value_get_object(json)) != NULL)
+            {
+                /*Codes_SRS_MODBUS_READ_JSON_99_047: [ If `args` is an object, ModbusRead_CreateFromJson shall read the servers from its "servers" array and the poll worker settings from its "workers", "cpuAffinity" and "startupTimeout" values. ]*/
+                arg_array = json_object_get_array(arg_object, "servers");
+            }
             if (arg_array == NULL)
             {
                 LogError("json_value_get_array failed arg");
             }
             else
             {
-                result = addAllServers(arg_array);
+                MODBUS_READ_CONFIG * servers = addAllServers(arg_array);
+                if (servers != NULL)
+                {
+                    result = malloc(sizeof(MODBUS_READ_MODULE_CONFIG));
+                    if (result == NULL)
+                    {
+                        LogError("unable to malloc");
+                        modbus_config_cleanup(servers);
+                    }
+                    else
+                    {
+                        result->servers = servers;
+                        result->startup_timeout = 0;
+                        if (arg_object != NULL && !addWorkers(result, arg_object))
+                        {
+                            modbus_config_cleanup(servers);
+                            free(result);
+                            result = NULL;
+                        }
+                    }
+                }
             }
             json_value_free(json);
         }
@@ -1456,7 +3543,8 @@ static void* ModbusRead_ParseConfigurationFromJson(const char* configuration)
 
 static void ModbusRead_FreeConfiguration(void* configuration)
 {
-        /*Codes_SRS_MODBUS_READ_99_006: [ ModbusRead_FreeConfiguration shall do nothing, cleanup is done in ModbusRead_Destroy. ]*/
+        /*Codes_SRS_MODBUS_READ_99_006: [ ModbusRead_FreeConfiguration shall free the module configuration, the servers it lists are cleaned up in ModbusRead_Destroy. ]*/
+        free(configuration);
 }
 static const MODULE_API_1 moduleInterface = 
 {
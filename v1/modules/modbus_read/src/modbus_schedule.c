@@ -0,0 +1,68 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdbool.h>
+#include "modbus_schedule.h"
+
+static bool is_scheduled_before(SCHEDULE_ENTRY * left, SCHEDULE_ENTRY * right)
+{
+    return left->due_time < right->due_time;
+}
+static void schedule_sift_up(SCHEDULE_ENTRY * schedule, size_t entry_i)
+{
+    while (entry_i > 0)
+    {
+        size_t parent_i = (entry_i - 1) / 2;
+        if (!is_scheduled_before(&schedule[entry_i], &schedule[parent_i]))
+            break;
+        SCHEDULE_ENTRY temp = schedule[entry_i];
+        schedule[entry_i] = schedule[parent_i];
+        schedule[parent_i] = temp;
+        entry_i = parent_i;
+    }
+}
+static void schedule_sift_down(SCHEDULE_ENTRY * schedule, size_t count, size_t entry_i)
+{
+    while (1)
+    {
+        size_t first_i = entry_i;
+        size_t child_i = 2 * entry_i + 1;
+        if (child_i < count && is_scheduled_before(&schedule[child_i], &schedule[first_i]))
+            first_i = child_i;
+        if (child_i + 1 < count && is_scheduled_before(&schedule[child_i + 1], &schedule[first_i]))
+            first_i = child_i + 1;
+        if (first_i == entry_i)
+            break;
+        SCHEDULE_ENTRY temp = schedule[entry_i];
+        schedule[entry_i] = schedule[first_i];
+        schedule[first_i] = temp;
+        entry_i = first_i;
+    }
+}
+void modbus_schedule_add(SCHEDULE_ENTRY * schedule, size_t * count, uint64_t due_time, MODBUS_READ_CONFIG * server, MODBUS_READ_OPERATION * operation)
+{
+    SCHEDULE_ENTRY * entry = &schedule[*count];
+    entry->due_time = due_time;
+    entry->server = server;
+    entry->operation = operation;
+    schedule_sift_up(schedule, (*count)++);
+}
+void modbus_schedule_run(SCHEDULE_ENTRY * schedule, size_t count, uint64_t now)
+{
+    while (count > 0 && schedule[0].due_time <= now)
+    {
+        SCHEDULE_ENTRY * entry = &schedule[0];
+        if (!entry->operation->due)
+        {
+            entry->operation->due = 1;
+            entry->server->due_count++;
+        }
+        entry->due_time += entry->operation->read_interval;
+        if (entry->due_time <= now)
+        {
+            //missed deadlines are skipped rather than replayed
+            entry->due_time += ((now - entry->due_time) / entry->operation->read_interval + 1) * entry->operation->read_interval;
+        }
+        schedule_sift_down(schedule, count, 0);
+    }
+}
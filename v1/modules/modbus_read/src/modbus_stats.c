@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include "modbus_stats.h"
+
+#define SUB_BUCKETS (1u << MODBUS_HISTOGRAM_SUB_BITS)
+
+static unsigned int get_exponent(uint64_t value)
+{
+#ifdef __GNUC__
+    return 63 - (unsigned int)__builtin_clzll(value);
+#else
+    unsigned int exponent = 0;
+    while (value >>= 1)
+        exponent++;
+    return exponent;
+#endif
+}
+static unsigned int get_bucket(uint64_t value_us)
+{
+    unsigned int exponent;
+
+    if (value_us < SUB_BUCKETS)
+        return (unsigned int)value_us;
+    exponent = get_exponent(value_us);
+    if (exponent > MODBUS_HISTOGRAM_MAX_EXPONENT)
+        return MODBUS_HISTOGRAM_BUCKETS - 1;
+    //the bits below the leading one pick the linear step inside the power of two
+    return ((exponent - MODBUS_HISTOGRAM_SUB_BITS + 1) << MODBUS_HISTOGRAM_SUB_BITS) + (unsigned int)(value_us >> (exponent - MODBUS_HISTOGRAM_SUB_BITS)) - SUB_BUCKETS;
+}
+static uint32_t get_bucket_upper_bound(unsigned int bucket)
+{
+    unsigned int shift;
+
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    shift = (bucket >> MODBUS_HISTOGRAM_SUB_BITS) - 1;
+    return ((SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1)) + 1) << shift) - 1;
+}
+void modbus_histogram_record(MODBUS_LATENCY_HISTOGRAM * histogram, uint64_t value_us)
+{
+    uint32_t value = (value_us > UINT32_MAX) ? UINT32_MAX : (uint32_t)value_us;
+
+    histogram->buckets[get_bucket(value_us)]++;
+    histogram->count++;
+    histogram->sum_us += value;
+    if (value > histogram->max_us)
+        histogram->max_us = value;
+}
+uint32_t modbus_histogram_percentile(const MODBUS_LATENCY_HISTOGRAM * histogram, unsigned int percent)
+{
+    //rank of the sample, rounded up so that the 100th percentile is the last one
+    uint64_t rank = ((uint64_t)histogram->count * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    if (histogram->count == 0)
+        return 0;
+    if (rank == 0)
+        rank = 1;
+    for (unsigned int bucket = 0; bucket < MODBUS_HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank)
+        {
+            //the last bucket also holds the values past it, its bound says nothing about them
+            uint32_t upper_bound = (bucket < MODBUS_HISTOGRAM_BUCKETS - 1) ? get_bucket_upper_bound(bucket) : UINT32_MAX;
+            return (upper_bound < histogram->max_us) ? upper_bound : histogram->max_us;
+        }
+    }
+    return histogram->max_us;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include "modbus_write.h"
+
+bool modbus_write_is_coil(unsigned char function_code)
+{
+    return function_code == 5 || function_code == 15;
+}
+int modbus_write_encode_pdu(unsigned char * buf, MODBUS_WRITE * modbus_write)
+{
+    unsigned short * _pU16;
+    int byte_count;
+    //encoding PDU
+    buf[0] = modbus_write->function_code;  //function code
+    _pU16 = (unsigned short *)(buf + 1);
+    *_pU16 = htons(modbus_write->address - 1);         //addr (2 bytes)
+    _pU16 = (unsigned short *)(buf + 3);
+    if (buf[0] == 5)//single coil
+    {
+        *_pU16 = htons((modbus_write->data[0] & 1) ? 0XFF00 : 0);
+        return 5;
+    }
+    else if (buf[0] == 6)//single register
+    {
+        buf[3] = modbus_write->data[0];
+        buf[4] = modbus_write->data[1];
+        return 5;
+    }
+    //multiple coils or registers: quantity (2 bytes), byte count (1 byte), values
+    *_pU16 = htons(modbus_write->count);
+    byte_count = (buf[0] == 15) ? (modbus_write->count + 7) / 8 : modbus_write->count * 2;
+    buf[5] = (unsigned char)byte_count;
+    memcpy(buf + 6, modbus_write->data, byte_count);
+    return 6 + byte_count;
+}
+static void set_write_value(unsigned char * data, size_t index, bool coils, unsigned short value)
+{
+    if (!coils)
+    {
+        data[index * 2] = (unsigned char)(value >> 8);
+        data[index * 2 + 1] = (unsigned char)(value & 0xFF);
+    }
+    else if (value)
+        data[index / 8] |= (unsigned char)(1 << (index % 8));
+    else
+        data[index / 8] &= (unsigned char)~(1 << (index % 8));
+}
+static unsigned short get_write_value(const unsigned char * data, size_t index, bool coils)
+{
+    if (!coils)
+        return (unsigned short)((data[index * 2] << 8) | data[index * 2 + 1]);
+    return (data[index / 8] >> (index % 8)) & 1;
+}
+unsigned short modbus_write_parse_values(const char * value_str, bool coils, unsigned char * data)
+{
+    unsigned short count = 0;
+    unsigned short max_count = coils ? MODBUS_MAX_WRITE_BITS : MODBUS_MAX_WRITE_REGISTERS;
+
+    memset(data, 0, MODBUS_MAX_WRITE_DATA);
+    while (1)
+    {
+        char * end;
+        long value = strtol(value_str, &end, 10);
+        if (end == value_str || count == max_count)
+            return 0;
+        //as for FC5, only 1 turns a coil on
+        set_write_value(data, count++, coils, coils ? (value == 1) : (unsigned short)value);
+        while (isspace((unsigned char)*end))
+            end++;
+        if (*end == '\0')
+            return count;
+        if (*end != ',')
+            return 0;
+        value_str = end + 1;
+    }
+}
+//the order of the queued writes is kept, so only the last one queued may take another in
+bool modbus_write_merge(MODBUS_WRITE * target, unsigned char uid, unsigned char function_code, unsigned short address, unsigned short count, const unsigned char * data)
+{
+    bool coils = modbus_write_is_coil(function_code);
+    //joining writes of adjoining cells would turn FC5/FC6 into FC15/FC16, which not every device supports
+    bool adjoining = (address == target->address + target->count || target->address == address + count);
+    unsigned int first = (target->address < address) ? target->address : address;
+    unsigned int end = (target->address + target->count > address + count) ? target->address + target->count : address + count;
+    unsigned char merged[MODBUS_MAX_WRITE_DATA];
+
+    if (target->state != WRITE_QUEUED || target->uid != uid || modbus_write_is_coil(target->function_code) != coils ||
+        address > target->address + target->count || target->address > address + count ||
+        (adjoining && (function_code < 15 || target->function_code < 15)) ||
+        end - first > (unsigned int)(coils ? MODBUS_MAX_WRITE_BITS : MODBUS_MAX_WRITE_REGISTERS))
+    {
+        return false;
+    }
+
+    memset(merged, 0, sizeof(merged));
+    for (size_t value_i = 0; value_i < target->count; value_i++)
+        set_write_value(merged, target->address - first + value_i, coils, get_write_value(target->data, value_i, coils));
+    for (size_t value_i = 0; value_i < count; value_i++)
+        set_write_value(merged, address - first + value_i, coils, get_write_value(data, value_i, coils));
+    memcpy(target->data, merged, sizeof(merged));
+    target->address = (unsigned short)first;
+    target->count = (unsigned short)(end - first);
+    if (target->count > 1)
+        target->function_code = coils ? 15 : 16;
+    return true;
+}
@@ -0,0 +1,111 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "modbus_crc.h"
+
+#define DEFAULT_ITERATIONS 1000000
+
+//the bit by bit implementation the table driven engine replaced, kept as the reference
+static unsigned short bitwise_crc16(const unsigned char * message, size_t length)
+{
+    unsigned short crc = 0xFFFF;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= message[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x0001)
+                crc = (unsigned short)((crc >> 1) ^ 0xA001);
+            else
+                crc = (unsigned short)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static double get_seconds(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+typedef unsigned short(*crc_function)(const unsigned char *, size_t);
+
+static double run(crc_function crc, unsigned char * frame, size_t length, long iterations, unsigned short * sink)
+{
+    double start = get_seconds();
+    for (long i = 0; i < iterations; i++)
+    {
+        //feed the previous result back so the calls cannot be hoisted out of the loop
+        frame[0] = (unsigned char)*sink;
+        *sink ^= crc(frame, length);
+    }
+    return (get_seconds() - start) * 1e9 / (double)iterations;
+}
+
+static int check(void)
+{
+    unsigned char frame[300];
+    int fail = 0;
+
+    if (modbus_crc16((const unsigned char *)"123456789", 9) != 0x4B37)
+    {
+        printf("check value mismatch: 0x%04X\n", modbus_crc16((const unsigned char *)"123456789", 9));
+        fail = 1;
+    }
+    srand(1);
+    for (size_t length = 0; length < sizeof(frame) && !fail; length++)
+    {
+        for (size_t i = 0; i < length; i++)
+            frame[i] = (unsigned char)rand();
+        if (modbus_crc16(frame, length) != bitwise_crc16(frame, length))
+        {
+            printf("mismatch on a %zu byte frame\n", length);
+            fail = 1;
+        }
+    }
+    return fail;
+}
+
+int main(int argc, char ** argv)
+{
+    static const size_t lengths[] = { 8, 256 };
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    unsigned char frame[256];
+    unsigned short sink = 0;
+
+    if (iterations <= 0 || check() != 0)
+        return 1;
+
+    for (size_t i = 0; i < sizeof(frame); i++)
+        frame[i] = (unsigned char)(i * 31 + 7);
+
+    printf("%-10s %12s %12s %9s\n", "frame", "bitwise ns", "table ns", "speedup");
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        double bitwise = run(bitwise_crc16, frame, lengths[i], iterations, &sink);
+        double table = run(modbus_crc16, frame, lengths[i], iterations, &sink);
+        printf("%4zu bytes %12.1f %12.1f %8.1fx\n", lengths[i], bitwise, table, bitwise / table);
+    }
+    //print the folded results so the optimizer has to keep every call
+    printf("(sink 0x%04X)\n", sink);
+    return 0;
+}
@@ -0,0 +1,399 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//the module is included below, its feature macro has to come before any system header
+#if !defined(WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static long allocations;
+
+static void * counted_malloc(size_t size)
+{
+    allocations++;
+    return malloc(size);
+}
+
+//the kernels are static, the module is compiled into the benchmark with its mallocs counted
+#define malloc counted_malloc
+#include "../../src/modbus_read.c"
+#undef malloc
+
+#define DEFAULT_ITERATIONS 100000
+#define OPERATION_COUNT 4
+
+typedef struct BENCH_SERVER_TAG
+{
+    const char * name;
+    int pdu_offset;
+    MODBUS_READ_CONFIG config;
+    MODBUS_READ_OPERATION operation;
+} BENCH_SERVER;
+
+typedef struct BENCH_RESULT_TAG
+{
+    double ns;
+    double allocs;
+} BENCH_RESULT;
+
+static double get_seconds(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+static BENCH_RESULT finish(double start, long start_allocations, long iterations)
+{
+    BENCH_RESULT result;
+    result.ns = (get_seconds() - start) * 1e9 / (double)iterations;
+    result.allocs = (double)(allocations - start_allocations) / (double)iterations;
+    return result;
+}
+
+//a server with one read of every cell a response can carry, so the telemetry buffer fits the largest one
+static int init_server(BENCH_SERVER * server, const char * name, const char * server_str, int pdu_offset)
+{
+    memset(server, 0, sizeof(*server));
+    server->name = name;
+    server->pdu_offset = pdu_offset;
+    strcpy(server->config.server_str, server_str);
+    strcpy(server->config.mac_address, "01:01:01:01:01:01");
+    strcpy(server->config.device_type, "powerMeter");
+    server->config.p_operation = &server->operation;
+    server->operation.unit_id = 1;
+    server->operation.function_code = 1;
+    server->operation.address = 1;
+    server->operation.length = MODBUS_MAX_READ_BITS;
+    server->operation.in_cycle = 1;
+
+    set_server_callbacks(&server->config);
+    create_telemetry_buffer(&server->config);
+    server->config.sqlite_upsert = malloc(BUFSIZE);
+    if (server->config.telemetry == NULL || server->config.sqlite_upsert == NULL)
+    {
+        printf("unable to allocate the payload buffers of %s\n", name);
+        return 1;
+    }
+    return 0;
+}
+
+static void deinit_server(BENCH_SERVER * server)
+{
+    free(server->config.telemetry);
+    free(server->config.sqlite_upsert);
+}
+
+static void set_operation(BENCH_SERVER * server, unsigned char function_code, unsigned short length)
+{
+    server->operation.function_code = function_code;
+    server->operation.length = length;
+}
+
+//a response to the current read in the server's framing, with a pattern of values in every cell
+static void make_response(BENCH_SERVER * server)
+{
+    MODBUS_READ_OPERATION * operation = &server->operation;
+    unsigned char * pdu = operation->response + server->pdu_offset;
+    bool bits = operation->function_code == 1 || operation->function_code == 2;
+    unsigned char byte_count = (unsigned char)(bits ? (operation->length + 7) / 8 : operation->length * 2);
+    unsigned short crc;
+
+    memset(operation->response, 0, sizeof(operation->response));
+    pdu[0] = operation->function_code;
+    pdu[1] = byte_count;
+    for (int i = 0; i < byte_count; i++)
+        pdu[2 + i] = (unsigned char)(i * 37 + 11);
+    if (server->pdu_offset == MODBUS_TCP_OFFSET)
+    {
+        encode_MBAP(operation->response, operation->unit_id, 2 + byte_count);
+        operation->response_len = MODBUS_TCP_OFFSET + 2 + byte_count;
+    }
+    else
+    {
+        operation->response[0] = operation->unit_id;
+        get_crc(operation->response, 3 + byte_count, &crc);
+        operation->response[3 + byte_count] = (unsigned char)(crc & 0xFF);
+        operation->response[4 + byte_count] = (unsigned char)(crc >> 8);
+        operation->response_len = 5 + byte_count;
+    }
+}
+
+static int check_encode(BENCH_SERVER * server)
+{
+    unsigned char request[256];
+    int len = 0;
+    unsigned short crc = 0;
+
+    for (unsigned char function_code = 1; function_code <= 4; function_code++)
+    {
+        set_operation(server, function_code, 10);
+        server->config.encode_read_cb(request, &len, &server->operation);
+        if (server->pdu_offset == MODBUS_COM_OFFSET)
+            get_crc(request, 6, &crc);
+        if ((server->pdu_offset == MODBUS_TCP_OFFSET) ? len != 12 || modbus_tcp_frame_len(request, len) != 12 : len != 8 || request[6] != (crc & 0xFF) || request[7] != (crc >> 8))
+        {
+            printf("%s read request %u is malformed\n", server->name, function_code);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//every cell of the response is reported once, and the telemetry stays one JSON object
+static int check_decode(BENCH_SERVER * server, unsigned char function_code, unsigned short length)
+{
+    MODBUS_READ_CONFIG * config = &server->config;
+    bool has_changes;
+    int reported;
+
+    set_operation(server, function_code, length);
+    make_response(server);
+    config->telemetry_len = config->telemetry_prefix_len;
+    reported = config->decode_response_cb(config, server->operation.response, &server->operation);
+    if (reported != length)
+    {
+        printf("%s decode of %u cells of function code %u reported %d\n", server->name, length, function_code, reported);
+        return 1;
+    }
+    if (process_operation(config, &server->operation, &has_changes) != 0 || !has_changes || config->telemetry[config->telemetry_len - 1] != '}' || strlen(config->telemetry) != config->telemetry_len)
+    {
+        printf("%s telemetry of %u cells of function code %u is malformed\n", server->name, length, function_code);
+        return 1;
+    }
+    return 0;
+}
+
+static BENCH_RESULT run_encode(BENCH_SERVER * server, long iterations, unsigned int * sink)
+{
+    unsigned char request[256];
+    int len = 0;
+    long start_allocations = allocations;
+    double start = get_seconds();
+
+    for (long i = 0; i < iterations; i++)
+    {
+        //feed the previous result back so the calls cannot be hoisted out of the loop
+        server->operation.address = (unsigned short)(*sink & 0xFF);
+        server->config.encode_read_cb(request, &len, &server->operation);
+        *sink ^= request[len - 1] + len;
+    }
+    return finish(start, start_allocations, iterations);
+}
+
+static BENCH_RESULT run_crc(unsigned char * frame, int length, long iterations, unsigned int * sink)
+{
+    unsigned short crc = 0;
+    long start_allocations = allocations;
+    double start = get_seconds();
+
+    for (long i = 0; i < iterations; i++)
+    {
+        frame[0] = (unsigned char)*sink;
+        get_crc(frame, length, &crc);
+        *sink ^= crc;
+    }
+    return finish(start, start_allocations, iterations);
+}
+
+static BENCH_RESULT run_decode(BENCH_SERVER * server, long iterations, unsigned int * sink)
+{
+    MODBUS_READ_CONFIG * config = &server->config;
+    unsigned char * data = server->operation.response + server->pdu_offset + 2;
+    long start_allocations = allocations;
+    double start = get_seconds();
+
+    for (long i = 0; i < iterations; i++)
+    {
+        config->telemetry_len = config->telemetry_prefix_len;
+        data[0] = (unsigned char)*sink;
+        *sink ^= config->decode_response_cb(config, server->operation.response, &server->operation) + (unsigned char)config->telemetry[config->telemetry_len - 2];
+    }
+    return finish(start, start_allocations, iterations);
+}
+
+//the whole cycle payload: timestamp, telemetry JSON and, when enabled, the sqlite statements
+static BENCH_RESULT run_payload(BENCH_SERVER * server, int sqlite_enabled, long iterations, unsigned int * sink)
+{
+    MODBUS_READ_CONFIG * config = &server->config;
+    unsigned char * data = server->operation.response + server->pdu_offset + 2;
+    bool has_changes;
+    long start_allocations;
+    double start;
+
+    config->sqlite_enabled = sqlite_enabled;
+    //the first localtime loads the time zone
+    process_operation(config, &server->operation, &has_changes);
+    start_allocations = allocations;
+    start = get_seconds();
+    for (long i = 0; i < iterations; i++)
+    {
+        data[0] = (unsigned char)*sink;
+        *sink ^= process_operation(config, &server->operation, &has_changes) + (unsigned int)config->telemetry_len + (unsigned int)config->sqlite_len;
+    }
+    config->sqlite_enabled = 0;
+    return finish(start, start_allocations, iterations);
+}
+
+static BENCH_RESULT run_stats(BENCH_SERVER * server, long iterations, unsigned int * sink)
+{
+    MODBUS_READ_CONFIG * config = &server->config;
+    long start_allocations = allocations;
+    double start = get_seconds();
+
+    for (long i = 0; i < iterations; i++)
+    {
+        config->stats.requests = *sink & 0xFFFF;
+        *sink ^= (unsigned int)encode_stats(config, 10000);
+    }
+    return finish(start, start_allocations, iterations);
+}
+
+static void print_result(const char * kernel, const char * server, const char * size, BENCH_RESULT result)
+{
+    printf("%-16s %-4s %-14s %12.1f %10.2f\n", kernel, server, size, result.ns, result.allocs);
+}
+
+//fewer iterations for the large responses, so every row takes about the same time
+static long scale_iterations(long iterations, unsigned short cells)
+{
+    long scaled = iterations / (1 + cells / 16);
+    return (scaled > 0) ? scaled : 1;
+}
+
+static int bench_decode(BENCH_SERVER * servers, size_t server_count, bool all_sizes, long iterations, unsigned int * sink)
+{
+    static const unsigned short bit_sizes[] = { 1, 8, 16, 100, 1000, MODBUS_MAX_READ_BITS };
+    static const unsigned short register_sizes[] = { 1, 10, 64, MODBUS_MAX_READ_REGISTERS };
+    static const char * kernels[] = { "", "decode coils", "decode inputs", "decode holding", "decode input reg" };
+
+    for (unsigned char function_code = 1; function_code <= 4; function_code++)
+    {
+        bool bits = function_code == 1 || function_code == 2;
+        const unsigned short * sizes = bits ? bit_sizes : register_sizes;
+        size_t size_count = bits ? sizeof(bit_sizes) / sizeof(bit_sizes[0]) : sizeof(register_sizes) / sizeof(register_sizes[0]);
+        unsigned short max_size = bits ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+
+        for (size_t size_i = 0; size_i < (all_sizes ? max_size : size_count); size_i++)
+        {
+            unsigned short length = all_sizes ? (unsigned short)(size_i + 1) : sizes[size_i];
+            char size[32];
+
+            SNPRINTF_S(size, sizeof(size), "%u %s", length, bits ? "bits" : "registers");
+            for (size_t server_i = 0; server_i < server_count; server_i++)
+            {
+                if (check_decode(&servers[server_i], function_code, length) != 0)
+                    return 1;
+                print_result(kernels[function_code], servers[server_i].name, size, run_decode(&servers[server_i], scale_iterations(iterations, length), sink));
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    static const int crc_lengths[] = { 8, 256 };
+    static const char * function_names[] = { "", "FC1", "FC2", "FC3", "FC4" };
+    long iterations = DEFAULT_ITERATIONS;
+    bool all_sizes = false;
+    BENCH_SERVER servers[2];
+    MODBUS_READ_OPERATION stats_operations[OPERATION_COUNT];
+    unsigned char frame[256];
+    unsigned int sink = 0;
+    int ret = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--all") == 0)
+            all_sizes = true;
+        else
+            iterations = atol(argv[i]);
+    }
+    if (iterations <= 0)
+    {
+        //--all decodes every response size, thousands of rows: pass fewer iterations with it
+        printf("usage: %s [iterations] [--all]\n", argv[0]);
+        return 1;
+    }
+
+    //the per cell LogInfo would dominate every decode
+    xlogging_set_log_function(NULL);
+    if (init_server(&servers[0], "tcp", "127.0.0.1", MODBUS_TCP_OFFSET) != 0 ||
+        init_server(&servers[1], "com", "COM1", MODBUS_COM_OFFSET) != 0 ||
+        check_encode(&servers[0]) != 0 || check_encode(&servers[1]) != 0)
+    {
+        return 1;
+    }
+
+    printf("%-16s %-4s %-14s %12s %10s\n", "kernel", "link", "size", "ns/op", "allocs/op");
+    for (unsigned char function_code = 1; function_code <= 4; function_code++)
+    {
+        for (size_t server_i = 0; server_i < 2; server_i++)
+        {
+            set_operation(&servers[server_i], function_code, 10);
+            print_result("encode read", servers[server_i].name, function_names[function_code], run_encode(&servers[server_i], iterations, &sink));
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(frame); i++)
+        frame[i] = (unsigned char)(i * 31 + 7);
+    for (size_t i = 0; i < sizeof(crc_lengths) / sizeof(crc_lengths[0]); i++)
+    {
+        char size[32];
+        SNPRINTF_S(size, sizeof(size), "%d bytes", crc_lengths[i]);
+        print_result("crc", "com", size, run_crc(frame, crc_lengths[i], iterations, &sink));
+    }
+
+    if (bench_decode(servers, 2, all_sizes, iterations, &sink) != 0)
+    {
+        ret = 1;
+    }
+    else
+    {
+        //a typical cycle: ten holding registers, the sqlite statements of all of them fit the buffer
+        set_operation(&servers[0], 3, 10);
+        make_response(&servers[0]);
+        print_result("payload json", "tcp", "10 registers", run_payload(&servers[0], 0, iterations, &sink));
+        print_result("payload sqlite", "tcp", "10 registers", run_payload(&servers[0], 1, iterations, &sink));
+
+        memset(stats_operations, 0, sizeof(stats_operations));
+        for (size_t i = 0; i < OPERATION_COUNT; i++)
+        {
+            stats_operations[i].function_code = (unsigned char)(i + 1);
+            stats_operations[i].address = (unsigned short)(i * 100 + 1);
+            stats_operations[i].length = 10;
+            stats_operations[i].p_next = (i + 1 < OPERATION_COUNT) ? &stats_operations[i + 1] : NULL;
+        }
+        servers[0].config.p_operation = stats_operations;
+        servers[0].config.stats_interval = 10000;
+        create_stats_buffer(&servers[0].config);
+        if (servers[0].config.stats_message == NULL)
+        {
+            ret = 1;
+        }
+        else
+        {
+            print_result("stats", "tcp", "4 operations", run_stats(&servers[0], iterations, &sink));
+            free(servers[0].config.stats_message);
+        }
+        servers[0].config.p_operation = &servers[0].operation;
+    }
+
+    deinit_server(&servers[0]);
+    deinit_server(&servers[1]);
+    //print the folded results so the optimizer has to keep every call
+    printf("(sink 0x%08X)\n", sink);
+    return ret;
+}
@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <cstdlib>
+#include <string>
 #ifdef _CRTDBG_MAP_ALLOC
 #include <crtdbg.h>
 #endif
@@ -20,6 +21,10 @@
 #include "parson.h"
 
 #include "modbus_read.h"
+#include "modbus_plan.h"
+#include "modbus_schedule.h"
+#include "modbus_stats.h"
+#include "modbus_write.h"
 
 static CONSTBUFFER messageContent;
 
@@ -509,6 +514,79 @@ DECLARE_GLOBAL_MOCK_METHOD_1(CModbusreadMocks, , LOCK_RESULT, Lock_Deinit, LOCK_
 DECLARE_GLOBAL_MOCK_METHOD_2(CModbusreadMocks, , int, mallocAndStrcpy_s, char**, destination, const char*, source);
 
 
+typedef struct READ_OPERATION_SPEC_TAG
+{
+    unsigned char function_code;
+    unsigned short address;
+    unsigned short length;
+}READ_OPERATION_SPEC;
+
+//chains count operations of unit 1 read every second to the server, which merges adjacent reads, specs is NULL when their ranges do not matter
+static void init_read_operations(MODBUS_READ_CONFIG * config, MODBUS_READ_OPERATION * operations, const READ_OPERATION_SPEC * specs, size_t count)
+{
+    memset(config, 0, sizeof(MODBUS_READ_CONFIG));
+    memset(operations, 0, count * sizeof(MODBUS_READ_OPERATION));
+    config->coalesce_reads = MODBUS_COALESCE_ADJACENT;
+    config->p_operation = operations;
+    for (size_t i = 0; i < count; i++)
+    {
+        operations[i].unit_id = 1;
+        operations[i].function_code = (specs != NULL) ? specs[i].function_code : 3;
+        operations[i].address = (specs != NULL) ? specs[i].address : 0;
+        operations[i].length = (specs != NULL) ? specs[i].length : 0;
+        operations[i].read_interval = 1000;
+        operations[i].p_next = (i + 1 < count) ? &operations[i + 1] : NULL;
+    }
+}
+
+static size_t count_operations(MODBUS_READ_OPERATION * operation)
+{
+    size_t count = 0;
+    for (; operation; operation = operation->p_next)
+        count++;
+    return count;
+}
+
+//frees what the planner allocated: the chunks of split reads and the coalesced reads
+static void free_planned_operations(MODBUS_READ_OPERATION * operation, MODBUS_READ_OPERATION * configured, size_t configured_count)
+{
+    while (operation)
+    {
+        MODBUS_READ_OPERATION * next = operation->p_next;
+        if (operation->p_segment != NULL)
+            free_planned_operations(operation->p_segment, configured, configured_count);
+        if (operation < configured || operation >= configured + configured_count)
+            gballoc_free(operation);
+        operation = next;
+    }
+}
+
+//queues a write of value_str repeated repeat times, as "value,value,..."
+static void init_write(MODBUS_WRITE * modbus_write, unsigned char function_code, unsigned short address, const char * value_str, size_t repeat)
+{
+    std::string values;
+    for (size_t i = 0; i < repeat; i++)
+    {
+        if (i > 0)
+            values += ",";
+        values += value_str;
+    }
+    memset(modbus_write, 0, sizeof(MODBUS_WRITE));
+    modbus_write->uid = 1;
+    modbus_write->function_code = function_code;
+    modbus_write->address = address;
+    modbus_write->count = modbus_write_parse_values(values.c_str(), modbus_write_is_coil(function_code), modbus_write->data);
+    modbus_write->state = WRITE_QUEUED;
+}
+
+static MODBUS_LATENCY_HISTOGRAM * make_histogram(MODBUS_LATENCY_HISTOGRAM * histogram, uint64_t value_us, uint64_t other_us)
+{
+    memset(histogram, 0, sizeof(*histogram));
+    modbus_histogram_record(histogram, value_us);
+    modbus_histogram_record(histogram, other_us);
+    return histogram;
+}
+
 BEGIN_TEST_SUITE(modbus_read_ut)
 
     TEST_SUITE_INITIALIZE(TestClassInitialize)
@@ -640,6 +718,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
 
         STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "operations"))
             .IgnoreArgument(1);
@@ -658,6 +753,14 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+            .IgnoreArgument(1);
+
+        //the module configuration
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
 
         //Act
         auto n = Module_ParseConfigurationFromJson(config);
@@ -668,6 +771,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
 
         ///Cleanup
         auto handle = Module_Create(broker, n);
+        Module_FreeConfiguration(n);
         Module_Start(handle);
         Module_Destroy(handle);
     }
@@ -716,6 +820,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
                 .IgnoreArgument(1);
             STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
                 .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+                .IgnoreArgument(1);
+
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+                .IgnoreArgument(1);
 
             STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "operations"))
                 .IgnoreArgument(1);
@@ -735,6 +856,10 @@ BEGIN_TEST_SUITE(modbus_read_ut)
                     .IgnoreArgument(1);
                 STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
                     .IgnoreArgument(1);
+                STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+                    .IgnoreArgument(1);
+                STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+                    .IgnoreArgument(1);
             }
             {
                 STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
@@ -749,6 +874,10 @@ BEGIN_TEST_SUITE(modbus_read_ut)
                     .IgnoreArgument(1);
                 STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
                     .IgnoreArgument(1);
+                STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+                    .IgnoreArgument(1);
+                STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+                    .IgnoreArgument(1);
             }
         }
         {
@@ -778,6 +907,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
                 .IgnoreArgument(1);
             STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
                 .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+                .IgnoreArgument(1);
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+                .IgnoreArgument(1);
+
+            STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+                .IgnoreArgument(1);
 
             STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, "operations"))
                 .IgnoreArgument(1);
@@ -797,6 +943,10 @@ BEGIN_TEST_SUITE(modbus_read_ut)
                     .IgnoreArgument(1);
                 STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
                     .IgnoreArgument(1);
+                STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+                    .IgnoreArgument(1);
+                STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+                    .IgnoreArgument(1);
             }
             {
                 STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
@@ -811,9 +961,17 @@ BEGIN_TEST_SUITE(modbus_read_ut)
                     .IgnoreArgument(1);
                 STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
                     .IgnoreArgument(1);
+                STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+                    .IgnoreArgument(1);
+                STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+                    .IgnoreArgument(1);
             }
         }
 
+        //the module configuration
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+
         //Act
         auto n = Module_ParseConfigurationFromJson(config);
 
@@ -824,6 +982,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         ///Cleanup
 
         auto handle = Module_Create(broker, n);
+        Module_FreeConfiguration(n);
         Module_Start(handle);
         Module_Destroy(handle);
     }
@@ -903,6 +1062,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
 
         STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreArgument(1)
@@ -970,6 +1146,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -1028,6 +1221,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -1087,6 +1297,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -1146,6 +1373,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .SetFailReturn((const char*)NULL);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -1205,6 +1449,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1)
             .SetFailReturn((const char*)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -1260,6 +1521,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
 
         STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreArgument(1)
@@ -1281,6 +1559,10 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
@@ -1341,6 +1623,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
 
         STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreArgument(1)
@@ -1362,6 +1661,10 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
@@ -1422,6 +1725,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
 
         STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreArgument(1)
@@ -1443,6 +1763,10 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .SetFailReturn((const char*)NULL);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
@@ -1503,6 +1827,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
 
         STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreArgument(1)
@@ -1524,6 +1865,10 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "length"))
             .IgnoreArgument(1)
             .SetFailReturn((const char*)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "interval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "deadband"))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
@@ -1555,6 +1900,9 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         STRICT_EXPECTED_CALL(mocks, json_value_get_array(IGNORED_PTR_ARG))
             .IgnoreArgument(1)
             .SetFailReturn((JSON_Array*)NULL);
+        STRICT_EXPECTED_CALL(mocks, json_value_get_object(IGNORED_PTR_ARG))
+            .IgnoreArgument(1)
+            .SetFailReturn((JSON_Object*)NULL);
         STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
 
@@ -1614,6 +1962,23 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "sqliteEnabled"))
             .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "maxInFlight"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "coalesceReads"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "phaseSeed"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "snapshotInterval"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "connectTimeout"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMin"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "responseTimeoutMax"))
+            .IgnoreArgument(1);
+
+        STRICT_EXPECTED_CALL(mocks, json_object_get_string(IGNORED_PTR_ARG, "statsInterval"))
+            .IgnoreArgument(1);
 
         STRICT_EXPECTED_CALL(mocks, json_object_get_array(IGNORED_PTR_ARG, IGNORED_PTR_ARG))
             .IgnoreArgument(1)
@@ -1702,6 +2067,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         sprintf(config->mac_address, "01:01:01:01:01:01");
         sprintf(config->server_str, "127.0.0.1");
         sprintf(config->device_type, "AA");
+        MODBUS_READ_MODULE_CONFIG module_config = { config, 0 };
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
             .IgnoreArgument(1);
@@ -1717,7 +2083,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
 
 
         //Act
-        auto n = Module_Create(broker, config);
+        auto n = Module_Create(broker, &module_config);
         Module_Start(n);
 
         ///Assert
@@ -1741,6 +2107,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         sprintf(config->mac_address, "01:01:01:01:01:01");
         sprintf(config->server_str, "127.0.0.1");
         sprintf(config->device_type, "AA");
+        MODBUS_READ_MODULE_CONFIG module_config = { config, 0 };
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
             .IgnoreArgument(1)
@@ -1748,7 +2115,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
 
 
         //Act
-        auto n = Module_Create(broker, config);
+        auto n = Module_Create(broker, &module_config);
 
         ///Assert
         ASSERT_IS_NULL(n);
@@ -1769,6 +2136,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         sprintf(config->mac_address, "01:01:01:01:01:01");
         sprintf(config->server_str, "127.0.0.1");
         sprintf(config->device_type, "AA");
+        MODBUS_READ_MODULE_CONFIG module_config = { config, 0 };
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
             .IgnoreArgument(1);
@@ -1779,7 +2147,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
 
 
         //Act
-        auto n = Module_Create(broker, config);
+        auto n = Module_Create(broker, &module_config);
 
         ///Assert
         ASSERT_IS_NULL(n);
@@ -1801,6 +2169,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         sprintf(config->mac_address, "01:01:01:01:01:01");
         sprintf(config->server_str, "127.0.0.1");
         sprintf(config->device_type, "AA");
+        MODBUS_READ_MODULE_CONFIG module_config = { config, 0 };
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
             .IgnoreArgument(1);
@@ -1817,7 +2186,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
 
 
         //Act
-        auto n = Module_Create(broker, config);
+        auto n = Module_Create(broker, &module_config);
         Module_Start(n);
 
         ///Assert
@@ -1855,6 +2224,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         sprintf(config->mac_address, "01:01:01:01:01:01");
         sprintf(config->server_str, "127.0.0.1");
         sprintf(config->device_type, "AA");
+        MODBUS_READ_MODULE_CONFIG module_config = { config, 0 };
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
             .IgnoreArgument(1);
@@ -1865,7 +2235,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(3);
 
 
-        auto n = Module_Create(broker, config);
+        auto n = Module_Create(broker, &module_config);
         Module_Start(n);
 
         mocks.ResetAllCalls();
@@ -2029,6 +2399,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         sprintf(config->mac_address, "01:01:01:01:01:01");
         sprintf(config->server_str, "127.0.0.1");
         sprintf(config->device_type, "AA");
+        MODBUS_READ_MODULE_CONFIG module_config = { config, 0 };
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
             .IgnoreArgument(1);
@@ -2039,7 +2410,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(3);
 
 
-        auto n = Module_Create(broker, config);
+        auto n = Module_Create(broker, &module_config);
 
         mocks.ResetAllCalls();
 
@@ -2102,6 +2473,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
         sprintf(config->mac_address, "01:01:01:01:01:01");
         sprintf(config->server_str, "127.0.0.1");
         sprintf(config->device_type, "AA");
+        MODBUS_READ_MODULE_CONFIG module_config = { config, 0 };
 
         STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
             .IgnoreArgument(1);
@@ -2112,7 +2484,7 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(3);
 
 
-        auto n = Module_Create(broker, config);
+        auto n = Module_Create(broker, &module_config);
 
         mocks.ResetAllCalls();
 
@@ -2163,6 +2535,24 @@ BEGIN_TEST_SUITE(modbus_read_ut)
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, Unlock(fake_lock))
             .IgnoreArgument(1);
+        //the module is not polling yet, the write is answered as failed
+        STRICT_EXPECTED_CALL(mocks, Map_Create(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "modbusWrite", "result"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "source", "modbus"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Map_AddOrUpdate(IGNORED_PTR_ARG, "macAddress", "01:01:01:01:01:01"))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Message_Create(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Broker_Publish(broker, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+            .IgnoreArgument(2)
+            .IgnoreArgument(3);
+        STRICT_EXPECTED_CALL(mocks, Message_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, Map_Destroy(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, json_value_free(IGNORED_PTR_ARG))
             .IgnoreArgument(1);
         STRICT_EXPECTED_CALL(mocks, ConstMap_Destroy(IGNORED_PTR_ARG))
@@ -2178,4 +2568,900 @@ BEGIN_TEST_SUITE(modbus_read_ut)
 
         Module_Destroy(n);
     }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_coalesces_adjacent_and_overlapping_reads_in_address_order)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[3];
+        const READ_OPERATION_SPEC specs[] = { { 3, 10, 5 }, { 3, 1, 5 }, { 3, 4, 6 } };
+        init_read_operations(&config, operations, specs, 3);
+
+        //the sort array and the merged read
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 1, count_operations(config.p_operation));
+        ASSERT_ARE_EQUAL(int, 1, config.p_operation->address);
+        ASSERT_ARE_EQUAL(int, 14, config.p_operation->length);
+        ASSERT_IS_TRUE(config.p_operation->p_segment == &operations[1]);
+        ASSERT_IS_TRUE(operations[1].p_next == &operations[2]);
+        ASSERT_IS_TRUE(operations[2].p_next == &operations[0]);
+        ASSERT_IS_NULL(operations[0].p_next);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 3);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_coalesces_up_to_125_registers)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[2];
+        const READ_OPERATION_SPEC specs[] = { { 4, 1, 100 }, { 4, 101, 25 } };
+        init_read_operations(&config, operations, specs, 2);
+
+        //the sort array and the merged read
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 1, count_operations(config.p_operation));
+        ASSERT_ARE_EQUAL(int, MODBUS_MAX_READ_REGISTERS, config.p_operation->length);
+        ASSERT_ARE_EQUAL(size_t, 2, count_operations(config.p_operation->p_segment));
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 2);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_does_not_coalesce_past_125_registers)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[2];
+        const READ_OPERATION_SPEC specs[] = { { 3, 1, 100 }, { 3, 101, 26 } };
+        init_read_operations(&config, operations, specs, 2);
+
+        //the sort array only
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        ASSERT_IS_TRUE(config.p_operation == &operations[0]);
+        ASSERT_IS_TRUE(operations[0].p_next == &operations[1]);
+        ASSERT_IS_NULL(operations[1].p_next);
+        ASSERT_IS_NULL(operations[0].p_segment);
+        ASSERT_ARE_EQUAL(int, 100, operations[0].length);
+        ASSERT_ARE_EQUAL(int, 26, operations[1].length);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 2);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_coalesces_up_to_2000_bits)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[2];
+        const READ_OPERATION_SPEC specs[] = { { 1, 1, 1000 }, { 1, 1001, 1000 } };
+        init_read_operations(&config, operations, specs, 2);
+
+        //the sort array and the merged read
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 1, count_operations(config.p_operation));
+        ASSERT_ARE_EQUAL(int, MODBUS_MAX_READ_BITS, config.p_operation->length);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 2);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_does_not_coalesce_past_2000_bits)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[2];
+        const READ_OPERATION_SPEC specs[] = { { 2, 1, 1000 }, { 2, 1001, 1001 } };
+        init_read_operations(&config, operations, specs, 2);
+
+        //the sort array only
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 2, count_operations(config.p_operation));
+        ASSERT_IS_NULL(config.p_operation->p_segment);
+        ASSERT_IS_NULL(config.p_operation->p_next->p_segment);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 2);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_does_not_read_across_gaps_by_default)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[3];
+        const READ_OPERATION_SPEC specs[] = { { 3, 1, 10 }, { 3, 12, 10 }, { 3, 22, 10 } };
+        init_read_operations(&config, operations, specs, 3);
+
+        //the sort array and the merged read
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 2, count_operations(config.p_operation));
+        ASSERT_IS_TRUE(config.p_operation == &operations[0]);
+        ASSERT_ARE_EQUAL(int, 12, config.p_operation->p_next->address);
+        ASSERT_ARE_EQUAL(int, 20, config.p_operation->p_next->length);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 3);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_reads_across_gaps_cheaper_than_a_round_trip)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG tcp_config;
+        MODBUS_READ_CONFIG com_config;
+        MODBUS_READ_OPERATION tcp_operations[3];
+        MODBUS_READ_OPERATION com_operations[3];
+        //50 registers (100 bytes) fit under the 101 byte cost of a TCP round trip, 51 do not
+        const READ_OPERATION_SPEC tcp_specs[] = { { 3, 1, 10 }, { 3, 61, 10 }, { 3, 122, 4 } };
+        init_read_operations(&tcp_config, tcp_operations, tcp_specs, 3);
+        tcp_config.coalesce_reads = MODBUS_COALESCE_GAPS;
+        //9 registers (18 bytes) fit under the 20 byte cost of a serial round trip, 10 do not
+        const READ_OPERATION_SPEC com_specs[] = { { 3, 1, 10 }, { 3, 20, 10 }, { 3, 40, 10 } };
+        init_read_operations(&com_config, com_operations, com_specs, 3);
+        com_config.coalesce_reads = MODBUS_COALESCE_GAPS;
+
+        //the sort array and the merged read of each server
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&tcp_config, MODBUS_ROUND_TRIP_COST_TCP);
+        modbus_plan_read_operations(&com_config, MODBUS_ROUND_TRIP_COST_COM);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 2, count_operations(tcp_config.p_operation));
+        ASSERT_ARE_EQUAL(int, 70, tcp_config.p_operation->length);
+        ASSERT_IS_TRUE(tcp_config.p_operation->p_next == &tcp_operations[2]);
+        ASSERT_ARE_EQUAL(size_t, 2, count_operations(com_config.p_operation));
+        ASSERT_ARE_EQUAL(int, 29, com_config.p_operation->length);
+        ASSERT_IS_TRUE(com_config.p_operation->p_next == &com_operations[2]);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(tcp_config.p_operation, tcp_operations, 3);
+        free_planned_operations(com_config.p_operation, com_operations, 3);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_keeps_units_function_codes_and_intervals_apart)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[4];
+        const READ_OPERATION_SPEC specs[] = { { 3, 1, 10 }, { 3, 11, 10 }, { 4, 11, 10 }, { 3, 11, 10 } };
+        init_read_operations(&config, operations, specs, 4);
+        operations[1].read_interval = 500;
+        operations[3].unit_id = 2;
+
+        //the sort array only
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        //sorted by unit, function code, interval and address
+        ASSERT_IS_TRUE(config.p_operation == &operations[1]);
+        ASSERT_IS_TRUE(operations[1].p_next == &operations[0]);
+        ASSERT_IS_TRUE(operations[0].p_next == &operations[2]);
+        ASSERT_IS_TRUE(operations[2].p_next == &operations[3]);
+        ASSERT_IS_NULL(operations[3].p_next);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 4);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_does_not_coalesce_when_disabled)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[2];
+        const READ_OPERATION_SPEC specs[] = { { 3, 11, 10 }, { 3, 1, 10 } };
+        init_read_operations(&config, operations, specs, 2);
+        config.coalesce_reads = MODBUS_COALESCE_OFF;
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        ASSERT_IS_TRUE(config.p_operation == &operations[0]);
+        ASSERT_IS_TRUE(operations[0].p_next == &operations[1]);
+        ASSERT_IS_NULL(operations[1].p_next);
+        mocks.AssertActualAndExpectedCalls();
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_splits_reads_into_125_register_chunks)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[1];
+        const READ_OPERATION_SPEC specs[] = { { 3, 1, 300 } };
+        init_read_operations(&config, operations, specs, 1);
+
+        //two chunks, then the sort array
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        MODBUS_READ_OPERATION * chunk = config.p_operation;
+        ASSERT_ARE_EQUAL(size_t, 3, count_operations(chunk));
+        ASSERT_IS_TRUE(chunk == &operations[0]);
+        ASSERT_ARE_EQUAL(int, 1, chunk->address);
+        ASSERT_ARE_EQUAL(int, 125, chunk->length);
+        chunk = chunk->p_next;
+        ASSERT_ARE_EQUAL(int, 126, chunk->address);
+        ASSERT_ARE_EQUAL(int, 125, chunk->length);
+        ASSERT_ARE_EQUAL(int, 1000, (int)chunk->read_interval);
+        chunk = chunk->p_next;
+        ASSERT_ARE_EQUAL(int, 251, chunk->address);
+        ASSERT_ARE_EQUAL(int, 50, chunk->length);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 1);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_splits_reads_into_2000_bit_chunks)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[2];
+        const READ_OPERATION_SPEC specs[] = { { 1, 1, 2001 }, { 2, 1, 2000 } };
+        init_read_operations(&config, operations, specs, 2);
+
+        //one chunk, then the sort array
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 3, count_operations(config.p_operation));
+        ASSERT_ARE_EQUAL(int, 2000, operations[0].length);
+        ASSERT_ARE_EQUAL(int, 2001, operations[0].p_next->address);
+        ASSERT_ARE_EQUAL(int, 1, operations[0].p_next->length);
+        ASSERT_IS_TRUE(operations[0].p_next->p_next == &operations[1]);
+        ASSERT_ARE_EQUAL(int, 2000, operations[1].length);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 2);
+    }
+
+    TEST_FUNCTION(ModbusRead_PlanReadOperations_coalesces_the_remainder_of_a_split_read)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_READ_CONFIG config;
+        MODBUS_READ_OPERATION operations[2];
+        const READ_OPERATION_SPEC specs[] = { { 3, 1, 130 }, { 3, 131, 10 } };
+        init_read_operations(&config, operations, specs, 2);
+
+        //one chunk, then the sort array and the merged read
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_malloc(IGNORED_NUM_ARG))
+            .IgnoreArgument(1);
+        STRICT_EXPECTED_CALL(mocks, gballoc_free(IGNORED_PTR_ARG))
+            .IgnoreArgument(1);
+
+        ///act
+        modbus_plan_read_operations(&config, MODBUS_ROUND_TRIP_COST_TCP);
+
+        ///assert
+        //the full first chunk stays alone, the 5 registers left over are read with the next operation
+        ASSERT_ARE_EQUAL(size_t, 2, count_operations(config.p_operation));
+        ASSERT_IS_TRUE(config.p_operation == &operations[0]);
+        ASSERT_ARE_EQUAL(int, 125, operations[0].length);
+        MODBUS_READ_OPERATION * block = operations[0].p_next;
+        ASSERT_ARE_EQUAL(int, 126, block->address);
+        ASSERT_ARE_EQUAL(int, 15, block->length);
+        ASSERT_ARE_EQUAL(int, 126, block->p_segment->address);
+        ASSERT_IS_TRUE(block->p_segment->p_next == &operations[1]);
+        mocks.AssertActualAndExpectedCalls();
+
+        ///cleanup
+        free_planned_operations(config.p_operation, operations, 2);
+    }
+
+    TEST_FUNCTION(ModbusRead_Schedule_marks_operations_due_in_deadline_order)
+    {
+        ///arrange
+        MODBUS_READ_CONFIG server;
+        MODBUS_READ_OPERATION operations[3];
+        SCHEDULE_ENTRY schedule[3];
+        size_t count = 0;
+        init_read_operations(&server, operations, NULL, 3);
+        modbus_schedule_add(schedule, &count, 300, &server, &operations[0]);
+        modbus_schedule_add(schedule, &count, 100, &server, &operations[1]);
+        modbus_schedule_add(schedule, &count, 200, &server, &operations[2]);
+
+        ///act
+        modbus_schedule_run(schedule, count, 150);
+
+        ///assert
+        ASSERT_ARE_EQUAL(size_t, 3, count);
+        ASSERT_ARE_EQUAL(int, 1, server.due_count);
+        ASSERT_ARE_EQUAL(int, 0, operations[0].due);
+        ASSERT_ARE_EQUAL(int, 1, operations[1].due);
+        ASSERT_ARE_EQUAL(int, 0, operations[2].due);
+        ASSERT_IS_TRUE(schedule[0].operation == &operations[2]);
+        ASSERT_IS_TRUE(schedule[0].due_time == 200);
+
+        ///act
+        modbus_schedule_run(schedule, count, 300);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 3, server.due_count);
+        ASSERT_ARE_EQUAL(int, 1, operations[0].due);
+        ASSERT_ARE_EQUAL(int, 1, operations[2].due);
+        //the next deadline is one interval after the first one
+        ASSERT_IS_TRUE(schedule[0].operation == &operations[1]);
+        ASSERT_IS_TRUE(schedule[0].due_time == 1100);
+    }
+
+    TEST_FUNCTION(ModbusRead_Schedule_skips_missed_deadlines_without_drifting)
+    {
+        ///arrange
+        MODBUS_READ_CONFIG server;
+        MODBUS_READ_OPERATION operations[1];
+        SCHEDULE_ENTRY schedule[1];
+        size_t count = 0;
+        init_read_operations(&server, operations, NULL, 1);
+        operations[0].read_interval = 100;
+        modbus_schedule_add(schedule, &count, 100, &server, &operations[0]);
+        modbus_schedule_run(schedule, count, 130);
+        operations[0].due = 0;
+        server.due_count = 0;
+
+        ///act
+        //the deadlines at 200, 300 and 400 were missed
+        modbus_schedule_run(schedule, count, 455);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 1, server.due_count);
+        ASSERT_ARE_EQUAL(int, 1, operations[0].due);
+        ASSERT_IS_TRUE(schedule[0].due_time == 500);
+    }
+
+    TEST_FUNCTION(ModbusRead_Schedule_does_not_count_an_operation_that_is_still_due)
+    {
+        ///arrange
+        MODBUS_READ_CONFIG server;
+        MODBUS_READ_OPERATION operations[1];
+        SCHEDULE_ENTRY schedule[1];
+        size_t count = 0;
+        init_read_operations(&server, operations, NULL, 1);
+        operations[0].read_interval = 100;
+        modbus_schedule_add(schedule, &count, 100, &server, &operations[0]);
+
+        ///act
+        modbus_schedule_run(schedule, count, 100);
+        modbus_schedule_run(schedule, count, 200);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 1, server.due_count);
+        ASSERT_IS_TRUE(schedule[0].due_time == 300);
+    }
+
+    TEST_FUNCTION(ModbusRead_Schedule_keeps_the_earliest_deadline_first)
+    {
+        ///arrange
+        MODBUS_READ_CONFIG server;
+        MODBUS_READ_OPERATION operations[50];
+        SCHEDULE_ENTRY schedule[50];
+        uint64_t first_due[50];
+        size_t count = 0;
+        init_read_operations(&server, operations, NULL, 50);
+        for (size_t i = 0; i < 50; i++)
+        {
+            first_due[i] = (i * 37) % 50 * 10 + 10;
+            modbus_schedule_add(schedule, &count, first_due[i], &server, &operations[i]);
+        }
+
+        for (uint64_t now = 0; now <= 510; now += 25)
+        {
+            ///act
+            modbus_schedule_run(schedule, count, now);
+
+            ///assert
+            for (size_t i = 0; i < 50; i++)
+                ASSERT_ARE_EQUAL(int, (first_due[i] <= now) ? 1 : 0, operations[i].due);
+            for (size_t i = 1; i < count; i++)
+                ASSERT_IS_TRUE(schedule[(i - 1) / 2].due_time <= schedule[i].due_time);
+            ASSERT_IS_TRUE(schedule[0].due_time > now);
+        }
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteParseValues_packs_registers_big_endian)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        unsigned char data[MODBUS_MAX_WRITE_DATA];
+
+        ///act
+        unsigned short count = modbus_write_parse_values("1,258, 65535", false, data);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 3, count);
+        ASSERT_ARE_EQUAL(int, 0x00, data[0]);
+        ASSERT_ARE_EQUAL(int, 0x01, data[1]);
+        ASSERT_ARE_EQUAL(int, 0x01, data[2]);
+        ASSERT_ARE_EQUAL(int, 0x02, data[3]);
+        ASSERT_ARE_EQUAL(int, 0xFF, data[4]);
+        ASSERT_ARE_EQUAL(int, 0xFF, data[5]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteParseValues_packs_coils_from_the_low_bit)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        unsigned char data[MODBUS_MAX_WRITE_DATA];
+
+        ///act
+        //only 1 turns a coil on
+        unsigned short count = modbus_write_parse_values("1,0,1,1,2,0,0,0,1", true, data);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 9, count);
+        ASSERT_ARE_EQUAL(int, 0x0D, data[0]);
+        ASSERT_ARE_EQUAL(int, 0x01, data[1]);
+        ASSERT_ARE_EQUAL(int, 0x00, data[2]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteParseValues_accepts_up_to_123_registers)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE write_123;
+        MODBUS_WRITE write_124;
+
+        ///act
+        init_write(&write_123, 16, 1, "7", 123);
+        init_write(&write_124, 16, 1, "7", 124);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 123, write_123.count);
+        ASSERT_ARE_EQUAL(int, 0, write_124.count);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteParseValues_accepts_up_to_1968_coils)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE write_1968;
+        MODBUS_WRITE write_1969;
+
+        ///act
+        init_write(&write_1968, 15, 1, "1", 1968);
+        init_write(&write_1969, 15, 1, "1", 1969);
+
+        ///assert
+        ASSERT_ARE_EQUAL(int, 1968, write_1968.count);
+        ASSERT_ARE_EQUAL(int, 0xFF, write_1968.data[MODBUS_MAX_WRITE_DATA - 1]);
+        ASSERT_ARE_EQUAL(int, 0, write_1969.count);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteParseValues_rejects_malformed_lists)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        unsigned char data[MODBUS_MAX_WRITE_DATA];
+
+        ///act, assert
+        ASSERT_ARE_EQUAL(int, 0, modbus_write_parse_values("", false, data));
+        ASSERT_ARE_EQUAL(int, 0, modbus_write_parse_values("a", false, data));
+        ASSERT_ARE_EQUAL(int, 0, modbus_write_parse_values("1,", false, data));
+        ASSERT_ARE_EQUAL(int, 0, modbus_write_parse_values("1;2", false, data));
+        ASSERT_ARE_EQUAL(int, 0, modbus_write_parse_values("1,,2", true, data));
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteMerge_folds_an_overlapping_write_with_the_later_values)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE target;
+        MODBUS_WRITE later;
+        init_write(&target, 16, 10, "1,2,3", 1);
+        init_write(&later, 16, 11, "7,8,9", 1);
+
+        ///act
+        bool merged = modbus_write_merge(&target, later.uid, later.function_code, later.address, later.count, later.data);
+
+        ///assert
+        ASSERT_IS_TRUE(merged);
+        ASSERT_ARE_EQUAL(int, 16, target.function_code);
+        ASSERT_ARE_EQUAL(int, 10, target.address);
+        ASSERT_ARE_EQUAL(int, 4, target.count);
+        ASSERT_ARE_EQUAL(int, 1, target.data[1]);
+        ASSERT_ARE_EQUAL(int, 7, target.data[3]);
+        ASSERT_ARE_EQUAL(int, 8, target.data[5]);
+        ASSERT_ARE_EQUAL(int, 9, target.data[7]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteMerge_keeps_single_writes_to_adjoining_cells_apart)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE target;
+        MODBUS_WRITE other;
+        init_write(&target, 6, 10, "5", 1);
+
+        ///act, assert
+        //a device with only FC6 would reject the FC16 they would make
+        init_write(&other, 6, 9, "4", 1);
+        ASSERT_IS_TRUE(!modbus_write_merge(&target, other.uid, other.function_code, other.address, other.count, other.data));
+        init_write(&other, 6, 11, "6", 1);
+        ASSERT_IS_TRUE(!modbus_write_merge(&target, other.uid, other.function_code, other.address, other.count, other.data));
+        init_write(&other, 16, 11, "6,7", 1);
+        ASSERT_IS_TRUE(!modbus_write_merge(&target, other.uid, other.function_code, other.address, other.count, other.data));
+        //the same cell again stays an FC6 write with the later value
+        init_write(&other, 6, 10, "7", 1);
+        ASSERT_IS_TRUE(modbus_write_merge(&target, other.uid, other.function_code, other.address, other.count, other.data));
+        ASSERT_ARE_EQUAL(int, 6, target.function_code);
+        ASSERT_ARE_EQUAL(int, 10, target.address);
+        ASSERT_ARE_EQUAL(int, 1, target.count);
+        ASSERT_ARE_EQUAL(int, 7, target.data[1]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteMerge_joins_FC16_writes_to_adjoining_cells)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE target;
+        MODBUS_WRITE before;
+        MODBUS_WRITE after;
+        init_write(&target, 16, 10, "5,6", 1);
+        init_write(&before, 16, 8, "3,4", 1);
+        init_write(&after, 16, 12, "7", 1);
+
+        ///act
+        bool merged_before = modbus_write_merge(&target, before.uid, before.function_code, before.address, before.count, before.data);
+        bool merged_after = modbus_write_merge(&target, after.uid, after.function_code, after.address, after.count, after.data);
+
+        ///assert
+        ASSERT_IS_TRUE(merged_before);
+        ASSERT_IS_TRUE(merged_after);
+        ASSERT_ARE_EQUAL(int, 16, target.function_code);
+        ASSERT_ARE_EQUAL(int, 8, target.address);
+        ASSERT_ARE_EQUAL(int, 5, target.count);
+        ASSERT_ARE_EQUAL(int, 3, target.data[1]);
+        ASSERT_ARE_EQUAL(int, 5, target.data[5]);
+        ASSERT_ARE_EQUAL(int, 7, target.data[9]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteMerge_folds_coils_into_FC15)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE target;
+        MODBUS_WRITE later;
+        init_write(&target, 5, 8, "1", 1);
+        init_write(&later, 15, 3, "1,0,0,0,0,0", 1);
+
+        ///act
+        bool merged = modbus_write_merge(&target, later.uid, later.function_code, later.address, later.count, later.data);
+
+        ///assert
+        ASSERT_IS_TRUE(merged);
+        ASSERT_ARE_EQUAL(int, 15, target.function_code);
+        ASSERT_ARE_EQUAL(int, 3, target.address);
+        ASSERT_ARE_EQUAL(int, 6, target.count);
+        //coil 3 on, coil 8 turned off again by the later write
+        ASSERT_ARE_EQUAL(int, 0x01, target.data[0]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteMerge_keeps_writes_apart_that_cannot_be_one_request)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE target;
+        MODBUS_WRITE other;
+        init_write(&target, 16, 10, "1,2,3", 1);
+
+        ///act, assert
+        //a gap
+        init_write(&other, 6, 14, "1", 1);
+        ASSERT_IS_TRUE(!modbus_write_merge(&target, other.uid, other.function_code, other.address, other.count, other.data));
+        //another unit
+        init_write(&other, 16, 12, "1", 1);
+        ASSERT_IS_TRUE(!modbus_write_merge(&target, 2, other.function_code, other.address, other.count, other.data));
+        //coils and registers
+        init_write(&other, 15, 12, "1", 1);
+        ASSERT_IS_TRUE(!modbus_write_merge(&target, other.uid, other.function_code, other.address, other.count, other.data));
+        //already sent
+        target.state = WRITE_IN_FLIGHT;
+        init_write(&other, 16, 12, "1", 1);
+        ASSERT_IS_TRUE(!modbus_write_merge(&target, other.uid, other.function_code, other.address, other.count, other.data));
+        ASSERT_ARE_EQUAL(int, 10, target.address);
+        ASSERT_ARE_EQUAL(int, 3, target.count);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteMerge_stops_at_123_registers_and_1968_coils)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE registers;
+        MODBUS_WRITE coils;
+        MODBUS_WRITE other;
+        init_write(&registers, 16, 1, "1", 100);
+        init_write(&coils, 15, 1, "1", 1900);
+
+        ///act, assert
+        init_write(&other, 16, 101, "2", 24);
+        ASSERT_IS_TRUE(!modbus_write_merge(&registers, other.uid, other.function_code, other.address, other.count, other.data));
+        init_write(&other, 16, 101, "2", 23);
+        ASSERT_IS_TRUE(modbus_write_merge(&registers, other.uid, other.function_code, other.address, other.count, other.data));
+        ASSERT_ARE_EQUAL(int, 123, registers.count);
+
+        init_write(&other, 15, 1901, "1", 69);
+        ASSERT_IS_TRUE(!modbus_write_merge(&coils, other.uid, other.function_code, other.address, other.count, other.data));
+        init_write(&other, 15, 1901, "1", 68);
+        ASSERT_IS_TRUE(modbus_write_merge(&coils, other.uid, other.function_code, other.address, other.count, other.data));
+        ASSERT_ARE_EQUAL(int, 1968, coils.count);
+        ASSERT_ARE_EQUAL(int, 0xFF, coils.data[MODBUS_MAX_WRITE_DATA - 1]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteEncodePdu_encodes_single_writes)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE coil;
+        MODBUS_WRITE reg;
+        unsigned char buf[MODBUS_MAX_WRITE_DATA + 6];
+        init_write(&coil, 5, 20, "1", 1);
+        init_write(&reg, 6, 20, "4660", 1);
+
+        ///act, assert
+        ASSERT_ARE_EQUAL(int, 5, modbus_write_encode_pdu(buf, &coil));
+        ASSERT_ARE_EQUAL(int, 5, buf[0]);
+        ASSERT_ARE_EQUAL(int, 0, buf[1]);
+        ASSERT_ARE_EQUAL(int, 19, buf[2]);
+        ASSERT_ARE_EQUAL(int, 0xFF, buf[3]);
+        ASSERT_ARE_EQUAL(int, 0x00, buf[4]);
+
+        ASSERT_ARE_EQUAL(int, 5, modbus_write_encode_pdu(buf, &reg));
+        ASSERT_ARE_EQUAL(int, 6, buf[0]);
+        ASSERT_ARE_EQUAL(int, 19, buf[2]);
+        ASSERT_ARE_EQUAL(int, 0x12, buf[3]);
+        ASSERT_ARE_EQUAL(int, 0x34, buf[4]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteEncodePdu_encodes_FC15_and_FC16)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE coils;
+        MODBUS_WRITE registers;
+        unsigned char buf[MODBUS_MAX_WRITE_DATA + 6];
+        init_write(&coils, 15, 1, "1,0,1,0,0,0,0,0,1,1", 1);
+        init_write(&registers, 16, 257, "1,2", 1);
+
+        ///act, assert
+        ASSERT_ARE_EQUAL(int, 8, modbus_write_encode_pdu(buf, &coils));
+        ASSERT_ARE_EQUAL(int, 15, buf[0]);
+        ASSERT_ARE_EQUAL(int, 0, buf[2]);
+        ASSERT_ARE_EQUAL(int, 0, buf[3]);
+        ASSERT_ARE_EQUAL(int, 10, buf[4]);
+        ASSERT_ARE_EQUAL(int, 2, buf[5]);
+        ASSERT_ARE_EQUAL(int, 0x05, buf[6]);
+        ASSERT_ARE_EQUAL(int, 0x03, buf[7]);
+
+        ASSERT_ARE_EQUAL(int, 10, modbus_write_encode_pdu(buf, &registers));
+        ASSERT_ARE_EQUAL(int, 16, buf[0]);
+        ASSERT_ARE_EQUAL(int, 1, buf[1]);
+        ASSERT_ARE_EQUAL(int, 0, buf[2]);
+        ASSERT_ARE_EQUAL(int, 2, buf[4]);
+        ASSERT_ARE_EQUAL(int, 4, buf[5]);
+        ASSERT_ARE_EQUAL(int, 1, buf[7]);
+        ASSERT_ARE_EQUAL(int, 2, buf[9]);
+    }
+
+    TEST_FUNCTION(ModbusRead_WriteEncodePdu_fills_the_largest_PDU)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_WRITE coils;
+        MODBUS_WRITE registers;
+        unsigned char buf[MODBUS_MAX_WRITE_DATA + 6];
+        init_write(&coils, 15, 1, "1", 1968);
+        init_write(&registers, 16, 1, "1", 123);
+
+        ///act, assert
+        ASSERT_ARE_EQUAL(int, 6 + 246, modbus_write_encode_pdu(buf, &coils));
+        ASSERT_ARE_EQUAL(int, 1968 >> 8, buf[3]);
+        ASSERT_ARE_EQUAL(int, 1968 & 0xFF, buf[4]);
+        ASSERT_ARE_EQUAL(int, 246, buf[5]);
+        ASSERT_ARE_EQUAL(int, 6 + 246, modbus_write_encode_pdu(buf, &registers));
+        ASSERT_ARE_EQUAL(int, 123, buf[4]);
+        ASSERT_ARE_EQUAL(int, 246, buf[5]);
+    }
+
+    TEST_FUNCTION(ModbusRead_Histogram_splits_the_buckets_at_their_boundaries)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_LATENCY_HISTOGRAM histogram;
+        const uint64_t large_us = 1000000;
+
+        ///act, assert
+        //with a larger second sample the median is the upper bound of the first sample's bucket
+        ASSERT_ARE_EQUAL(size_t, 3, modbus_histogram_percentile(make_histogram(&histogram, 3, large_us), 50));
+        ASSERT_ARE_EQUAL(int, 1, histogram.buckets[3]);
+        ASSERT_ARE_EQUAL(size_t, 4, modbus_histogram_percentile(make_histogram(&histogram, 4, large_us), 50));
+        ASSERT_ARE_EQUAL(int, 1, histogram.buckets[4]);
+        ASSERT_ARE_EQUAL(size_t, 7, modbus_histogram_percentile(make_histogram(&histogram, 7, large_us), 50));
+        ASSERT_ARE_EQUAL(int, 1, histogram.buckets[7]);
+        ASSERT_ARE_EQUAL(size_t, 9, modbus_histogram_percentile(make_histogram(&histogram, 8, large_us), 50));
+        ASSERT_ARE_EQUAL(int, 1, histogram.buckets[8]);
+        ASSERT_ARE_EQUAL(size_t, 9, modbus_histogram_percentile(make_histogram(&histogram, 9, large_us), 50));
+        ASSERT_ARE_EQUAL(int, 1, histogram.buckets[8]);
+        ASSERT_ARE_EQUAL(size_t, 11, modbus_histogram_percentile(make_histogram(&histogram, 10, large_us), 50));
+        ASSERT_ARE_EQUAL(int, 1, histogram.buckets[9]);
+    }
+
+    TEST_FUNCTION(ModbusRead_Histogram_reaches_2_to_the_26_us)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_LATENCY_HISTOGRAM histogram;
+        const uint64_t top_us = (uint64_t)1 << MODBUS_HISTOGRAM_MAX_EXPONENT;
+
+        ///act, assert
+        ASSERT_ARE_EQUAL(size_t, (size_t)top_us - 1, modbus_histogram_percentile(make_histogram(&histogram, top_us - 1, top_us * 4), 50));
+        ASSERT_ARE_EQUAL(int, 1, histogram.buckets[MODBUS_HISTOGRAM_BUCKETS - 5]);
+        ASSERT_ARE_EQUAL(size_t, (size_t)(top_us + top_us / 4 - 1), modbus_histogram_percentile(make_histogram(&histogram, top_us, top_us * 4), 50));
+        ASSERT_ARE_EQUAL(int, 1, histogram.buckets[MODBUS_HISTOGRAM_BUCKETS - 4]);
+        ASSERT_ARE_EQUAL(int, 1, make_histogram(&histogram, top_us * 2 - 1, 1)->buckets[MODBUS_HISTOGRAM_BUCKETS - 1]);
+    }
+
+    TEST_FUNCTION(ModbusRead_Histogram_counts_values_past_the_last_bucket_in_it)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_LATENCY_HISTOGRAM histogram;
+        const uint64_t top_us = (uint64_t)1 << MODBUS_HISTOGRAM_MAX_EXPONENT;
+        make_histogram(&histogram, top_us * 2, (uint64_t)1 << 40);
+
+        ///act, assert
+        ASSERT_ARE_EQUAL(int, 2, histogram.buckets[MODBUS_HISTOGRAM_BUCKETS - 1]);
+        ASSERT_ARE_EQUAL(size_t, 2, histogram.count);
+        ASSERT_ARE_EQUAL(size_t, UINT32_MAX, histogram.max_us);
+        ASSERT_ARE_EQUAL(size_t, UINT32_MAX, modbus_histogram_percentile(&histogram, 50));
+        ASSERT_ARE_EQUAL(size_t, UINT32_MAX, modbus_histogram_percentile(&histogram, 100));
+    }
+
+    TEST_FUNCTION(ModbusRead_Histogram_percentiles_of_an_empty_histogram_are_0)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_LATENCY_HISTOGRAM histogram;
+        memset(&histogram, 0, sizeof(histogram));
+
+        ///act, assert
+        ASSERT_ARE_EQUAL(size_t, 0, modbus_histogram_percentile(&histogram, 0));
+        ASSERT_ARE_EQUAL(size_t, 0, modbus_histogram_percentile(&histogram, 50));
+        ASSERT_ARE_EQUAL(size_t, 0, modbus_histogram_percentile(&histogram, 100));
+    }
+
+    TEST_FUNCTION(ModbusRead_Histogram_p100_is_the_largest_sample)
+    {
+        ///arrange
+        CModbusreadMocks mocks;
+        MODBUS_LATENCY_HISTOGRAM histogram;
+        const uint64_t samples[] = { 5, 130, 1000, 70000, 1234567, 90000000, 200000000 };
+        memset(&histogram, 0, sizeof(histogram));
+
+        for (size_t sample_i = 0; sample_i < sizeof(samples) / sizeof(samples[0]); sample_i++)
+        {
+            ///act
+            modbus_histogram_record(&histogram, samples[sample_i]);
+
+            ///assert
+            ASSERT_ARE_EQUAL(size_t, (size_t)samples[sample_i], histogram.max_us);
+            ASSERT_ARE_EQUAL(size_t, (size_t)samples[sample_i], modbus_histogram_percentile(&histogram, 100));
+        }
+    }
 END_TEST_SUITE(modbus_read_ut)
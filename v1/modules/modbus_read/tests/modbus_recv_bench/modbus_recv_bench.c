@@ -0,0 +1,175 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "modbus_frame.h"
+
+#define DEFAULT_ITERATIONS 100000
+//response to a read of 4 holding registers: MBAP + function code + byte count + 8 bytes
+#define RESPONSE_LEN 17
+#define MAX_BATCH 16
+
+static long recv_calls;
+
+static double get_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int counted_recv(int sock, unsigned char * buf, size_t len)
+{
+    recv_calls++;
+    return (int)recv(sock, buf, len, 0);
+}
+
+//the reader the buffered one replaced, kept as the reference: the MBAP header first, then the rest of the frame
+static int two_step_read(int sock, unsigned char * frame)
+{
+    int total = 0;
+    int expected = 7;
+    while (total < expected)
+    {
+        int recv_size = counted_recv(sock, frame + total, expected - total);
+        if (recv_size <= 0)
+            return -1;
+        total += recv_size;
+        if (total == 7)
+            expected = ((frame[4] << 8) | frame[5]) + 6;
+    }
+    return total;
+}
+
+typedef struct RX_BUFFER_TAG
+{
+    unsigned char buf[2048];
+    int len;
+} RX_BUFFER;
+
+//the buffered reader: one recv takes whatever has arrived, the frames are parsed from the buffer
+static int buffered_read(int sock, RX_BUFFER * rx, unsigned char * frame)
+{
+    int frame_len;
+    while ((frame_len = modbus_tcp_frame_len(rx->buf, rx->len)) == 0)
+    {
+        int recv_size = counted_recv(sock, rx->buf + rx->len, sizeof(rx->buf) - rx->len);
+        if (recv_size <= 0)
+            return -1;
+        rx->len += recv_size;
+    }
+    if (frame_len < 0)
+        return -1;
+    memcpy(frame, rx->buf, frame_len);
+    rx->len -= frame_len;
+    memmove(rx->buf, rx->buf + frame_len, rx->len);
+    return frame_len;
+}
+
+static int open_loopback(int * server, int * client)
+{
+    struct sockaddr_in address;
+    socklen_t address_len = sizeof(address);
+    int one = 1;
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listener, 1) != 0 ||
+        getsockname(listener, (struct sockaddr *)&address, &address_len) != 0 ||
+        (*client = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(*client, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        (*server = accept(listener, NULL, NULL)) < 0)
+    {
+        printf("unable to open a loopback connection\n");
+        return 1;
+    }
+    (void)setsockopt(*server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    close(listener);
+    return 0;
+}
+
+static void build_responses(unsigned char * responses, int batch)
+{
+    for (int i = 0; i < batch; i++)
+    {
+        unsigned char * response = responses + i * RESPONSE_LEN;
+        memset(response, 0, RESPONSE_LEN);
+        response[0] = (unsigned char)(i >> 8);  //transaction id
+        response[1] = (unsigned char)i;
+        response[5] = RESPONSE_LEN - 6;         //length of unit id + PDU
+        response[6] = 1;                        //unit id
+        response[7] = 3;                        //function code
+        response[8] = 8;                        //byte count
+        response[9 + (i % 8)] = (unsigned char)i;
+    }
+}
+
+//the server answers batch pipelined requests with one send, the client reads them back
+static int run(int server, int client, int batch, long iterations, int buffered, double * ns_per_response, double * recv_per_response)
+{
+    unsigned char responses[MAX_BATCH * RESPONSE_LEN];
+    unsigned char frame[MODBUS_TCP_MAX_FRAME_LEN];
+    RX_BUFFER rx;
+    double start;
+
+    build_responses(responses, batch);
+    rx.len = 0;
+    recv_calls = 0;
+    start = get_seconds();
+    for (long iteration = 0; iteration < iterations; iteration++)
+    {
+        if (send(server, responses, batch * RESPONSE_LEN, 0) != batch * RESPONSE_LEN)
+            return 1;
+        for (int i = 0; i < batch; i++)
+        {
+            int frame_len = buffered ? buffered_read(client, &rx, frame) : two_step_read(client, frame);
+            if (frame_len != RESPONSE_LEN || memcmp(frame, responses + i * RESPONSE_LEN, RESPONSE_LEN) != 0)
+            {
+                printf("response %d of a batch of %d read back wrong\n", i, batch);
+                return 1;
+            }
+        }
+    }
+    *ns_per_response = (get_seconds() - start) * 1e9 / ((double)iterations * batch);
+    *recv_per_response = (double)recv_calls / ((double)iterations * batch);
+    return 0;
+}
+
+int main(int argc, char ** argv)
+{
+    static const int batches[] = { 1, 4, 16 };
+    long iterations = argc > 1 ? atol(argv[1]) : DEFAULT_ITERATIONS;
+    int server;
+    int client;
+
+    if (iterations <= 0 || open_loopback(&server, &client) != 0)
+        return 1;
+
+    printf("%-9s %15s %15s %13s %13s\n", "pipelined", "two-step recv", "buffered recv", "two-step ns", "buffered ns");
+    for (size_t i = 0; i < sizeof(batches) / sizeof(batches[0]); i++)
+    {
+        double two_step_ns, two_step_recv, buffered_ns, buffered_recv;
+        if (run(server, client, batches[i], iterations, 0, &two_step_ns, &two_step_recv) != 0 ||
+            run(server, client, batches[i], iterations, 1, &buffered_ns, &buffered_recv) != 0)
+        {
+            return 1;
+        }
+        printf("%9d %15.2f %15.2f %13.0f %13.0f\n", batches[i], two_step_recv, buffered_recv, two_step_ns, buffered_ns);
+    }
+    close(client);
+    close(server);
+    return 0;
+}
@@ -0,0 +1,254 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//drives the serial wrapper of the iotedgeModbus module, comWrapper.c, against modbus_rtu_bus: one holding register is written, then read back
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#include "comWrapper.h"
+#include "farm_slave.h"
+
+#define DEFAULT_BAUD_RATE 9600
+#define DEFAULT_COUNT 10
+#define DEFAULT_REQUESTS 100
+#define MAX_READ_REGISTERS 125
+#define MAX_FRAME_LEN 256
+#define EXCEPTION_FRAME_LEN 5
+#define WRITE_VALUE 0x1234
+
+typedef struct CHECK_OPTIONS_TAG
+{
+    const char * device;
+    unsigned int baud_rate;
+    unsigned int data_bits;
+    char parity;
+    unsigned int stop_bits;
+    unsigned int unit;
+    unsigned int address;
+    unsigned int count;
+    unsigned long requests;
+}CHECK_OPTIONS;
+
+typedef struct CHECK_TAG
+{
+    CHECK_OPTIONS options;
+    int fd;
+    unsigned long long responses;
+    unsigned long long timeouts;
+    unsigned long long bad_responses;
+    unsigned long long exceptions;
+    unsigned long long wrong_values;
+    uint64_t min_us;
+    uint64_t max_us;
+    uint64_t sum_us;
+}CHECK;
+
+static void set_u16(unsigned char * buf, unsigned int value)
+{
+    buf[0] = (unsigned char)(value >> 8);
+    buf[1] = (unsigned char)(value & 0xFF);
+}
+static unsigned int get_u16(const unsigned char * buf)
+{
+    return (unsigned int)((buf[0] << 8) | buf[1]);
+}
+//reads until the frame is complete, an exception arrived or the line stayed silent for the 2s the wrapper waits, returns the bytes read
+static size_t read_frame(CHECK * check, unsigned char * frame, size_t frame_len)
+{
+    size_t len = 0;
+
+    while (len < frame_len)
+    {
+        ssize_t read_size = com_read(check->fd, frame + len, frame_len - len);
+        if (read_size <= 0)
+            break;
+        len += (size_t)read_size;
+        if (len >= EXCEPTION_FRAME_LEN && (frame[1] & 0x80) != 0)
+            return EXCEPTION_FRAME_LEN;
+    }
+    return len;
+}
+//sends the request PDU to the unit, returns the response PDU length or -1 if none usable came back
+static int transact(CHECK * check, const unsigned char * pdu, size_t pdu_len, unsigned char * response, size_t response_pdu_len)
+{
+    unsigned char request[MAX_FRAME_LEN];
+    size_t request_len = 1 + pdu_len + 2;
+    size_t response_len;
+    uint64_t start_us;
+    uint64_t round_trip_us;
+
+    request[0] = (unsigned char)check->options.unit;
+    memcpy(request + 1, pdu, pdu_len);
+    farm_set_crc(request, 1 + pdu_len);
+
+    start_us = farm_get_monotonic_us();
+    if (com_write(check->fd, request, request_len) != (ssize_t)request_len)
+    {
+        perror("com_write");
+        return -1;
+    }
+    response_len = read_frame(check, response, 1 + response_pdu_len + 2);
+    round_trip_us = farm_get_monotonic_us() - start_us;
+
+    if (response_len == 0)
+    {
+        check->timeouts++;
+        return -1;
+    }
+    if (response_len < EXCEPTION_FRAME_LEN || !farm_is_crc_valid(response, response_len) ||
+        response[0] != request[0] || (response[1] & 0x7F) != request[1])
+    {
+        check->bad_responses++;
+        //whatever is left of the frame would spoil the next one
+        (void)com_tciflush(check->fd);
+        return -1;
+    }
+    if (response[1] & 0x80)
+    {
+        check->exceptions++;
+        return -1;
+    }
+    check->responses++;
+    check->sum_us += round_trip_us;
+    if (check->min_us == 0 || round_trip_us < check->min_us)
+        check->min_us = round_trip_us;
+    if (round_trip_us > check->max_us)
+        check->max_us = round_trip_us;
+    return (int)response_len - 3;
+}
+static void run_check(CHECK * check)
+{
+    unsigned char pdu[5];
+    unsigned char response[MAX_FRAME_LEN];
+    size_t read_pdu_len = 2 + 2 * check->options.count;
+
+    //function code 6 echoes the request
+    pdu[0] = 6;
+    set_u16(pdu + 1, check->options.address);
+    set_u16(pdu + 3, WRITE_VALUE);
+    if (transact(check, pdu, sizeof(pdu), response, sizeof(pdu)) == (int)sizeof(pdu) && memcmp(response + 1, pdu, sizeof(pdu)) != 0)
+        check->wrong_values++;
+
+    pdu[0] = 3;
+    set_u16(pdu + 3, check->options.count);
+    for (unsigned long request_i = 1; request_i < check->options.requests; request_i++)
+    {
+        if (transact(check, pdu, sizeof(pdu), response, read_pdu_len) == (int)read_pdu_len &&
+            (response[2] != 2 * check->options.count || get_u16(response + 3) != WRITE_VALUE))
+        {
+            check->wrong_values++;
+        }
+    }
+}
+static void print_usage(const char * program)
+{
+    printf("usage: %s --device PATH [options]\n", program);
+    printf("  --device PATH        terminal of the bus, the link or the name modbus_rtu_bus prints\n");
+    printf("  --baud N             4800, 9600, 19200 or 38400, default %d\n", DEFAULT_BAUD_RATE);
+    printf("  --data-bits N        7 or 8, default 8\n");
+    printf("  --parity P           NONE, ODD or EVEN, default NONE\n");
+    printf("  --stop-bits N        1 or 2, default 1\n");
+    printf("  --unit N             unit id of the slave, default 1\n");
+    printf("  --address A          zero based holding register written and read back, default 0\n");
+    printf("  --count N            registers per read, default %d\n", DEFAULT_COUNT);
+    printf("  --requests N         the write and the reads after it, default %d\n", DEFAULT_REQUESTS);
+}
+static int parse_options(int argc, char ** argv, CHECK_OPTIONS * options)
+{
+    static const struct option long_options[] =
+    {
+        { "device", required_argument, NULL, 'p' },
+        { "baud", required_argument, NULL, 'b' },
+        { "data-bits", required_argument, NULL, 'D' },
+        { "parity", required_argument, NULL, 'P' },
+        { "stop-bits", required_argument, NULL, 'T' },
+        { "unit", required_argument, NULL, 'u' },
+        { "address", required_argument, NULL, 'a' },
+        { "count", required_argument, NULL, 'n' },
+        { "requests", required_argument, NULL, 'r' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option;
+
+    options->device = NULL;
+    options->baud_rate = DEFAULT_BAUD_RATE;
+    options->data_bits = 8;
+    options->parity = 'N';
+    options->stop_bits = 1;
+    options->unit = 1;
+    options->address = 0;
+    options->count = DEFAULT_COUNT;
+    options->requests = DEFAULT_REQUESTS;
+
+    while ((option = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'p': options->device = optarg; break;
+        case 'b': options->baud_rate = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'D': options->data_bits = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'P': options->parity = optarg[0]; break;
+        case 'T': options->stop_bits = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'u': options->unit = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'a': options->address = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'n': options->count = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'r': options->requests = strtoul(optarg, NULL, 10); break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (options->device == NULL || options->unit == 0 || options->unit > 247 || options->address > 0xFFFF ||
+        options->count == 0 || options->count > MAX_READ_REGISTERS || options->requests == 0 ||
+        (options->data_bits != 7 && options->data_bits != 8) ||
+        (options->parity != 'N' && options->parity != 'O' && options->parity != 'E') ||
+        (options->stop_bits != 1 && options->stop_bits != 2))
+    {
+        fprintf(stderr, "invalid options, the device is required and at most %d registers are read at once\n", MAX_READ_REGISTERS);
+        return -1;
+    }
+    return 0;
+}
+int main(int argc, char ** argv)
+{
+    CHECK check;
+    int parity_bit;
+
+    memset(&check, 0, sizeof(check));
+    if (parse_options(argc, argv, &check.options) != 0)
+        return 1;
+    parity_bit = (check.options.parity == 'O') ? 1 : (check.options.parity == 'E') ? 2 : 0;
+
+    check.fd = com_open(check.options.device);
+    if (check.fd < 0)
+    {
+        perror(check.options.device);
+        return 1;
+    }
+    if (com_set_interface_attribs(check.fd, (int)check.options.baud_rate, (int)check.options.data_bits, parity_bit, (int)check.options.stop_bits) != 0 ||
+        com_tciflush(check.fd) != 0)
+    {
+        fprintf(stderr, "unable to set up %s\n", check.options.device);
+        (void)com_close(check.fd);
+        return 1;
+    }
+
+    run_check(&check);
+    (void)com_close(check.fd);
+
+    printf("%lu requests, %llu responses, %llu timeouts, %llu bad responses, %llu exceptions, %llu wrong values\n", check.options.requests,
+        check.responses, check.timeouts, check.bad_responses, check.exceptions, check.wrong_values);
+    if (check.responses > 0)
+    {
+        printf("round trip min %lluus, mean %lluus, max %lluus\n", (unsigned long long)check.min_us,
+            (unsigned long long)(check.sum_us / check.responses), (unsigned long long)check.max_us);
+    }
+    return (check.responses == check.options.requests && check.wrong_values == 0) ? 0 : 1;
+}
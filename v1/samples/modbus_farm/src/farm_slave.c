@@ -0,0 +1,209 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "farm_slave.h"
+
+#define MAX_READ_REGISTERS 125
+#define MAX_READ_BITS 2000
+#define MAX_WRITE_REGISTERS 123
+#define MAX_WRITE_BITS 1968
+
+uint64_t farm_get_monotonic_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)(now.tv_nsec / 1000);
+}
+//the murmur3 finalizer: xorshift starts slowly from a small seed and never leaves 0, so every seed bit is spread over the state first
+uint32_t farm_spread_seed(uint32_t seed)
+{
+    uint32_t x = seed;
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return (x != 0) ? x : 1;
+}
+static unsigned short get_crc(const unsigned char * buf, size_t len)
+{
+    unsigned short crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (unsigned short)((crc >> 1) ^ 0xA001) : (unsigned short)(crc >> 1);
+    }
+    return crc;
+}
+void farm_set_crc(unsigned char * frame, size_t len)
+{
+    unsigned short crc = get_crc(frame, len);
+    frame[len] = (unsigned char)(crc & 0xFF);
+    frame[len + 1] = (unsigned char)(crc >> 8);
+}
+bool farm_is_crc_valid(const unsigned char * frame, size_t frame_len)
+{
+    return frame_len > 2 && get_crc(frame, frame_len - 2) == (unsigned short)(frame[frame_len - 2] | (frame[frame_len - 1] << 8));
+}
+static unsigned short get_u16(const unsigned char * buf)
+{
+    return (unsigned short)((buf[0] << 8) | buf[1]);
+}
+static void set_u16(unsigned char * buf, unsigned short value)
+{
+    buf[0] = (unsigned char)(value >> 8);
+    buf[1] = (unsigned char)(value & 0xFF);
+}
+//input register n counts up once every n % 8 + 1 seconds, so report by exception sees some cells change and others not
+static unsigned short get_input_register(FARM_SLAVE * slave, unsigned int address)
+{
+    uint64_t seconds = (farm_get_monotonic_us() - slave->start_us) / 1000000;
+    return (unsigned short)(slave->index * 1000 + address + seconds / (address % 8 + 1));
+}
+static unsigned char get_discrete_input(FARM_SLAVE * slave, unsigned int address)
+{
+    uint64_t seconds = (farm_get_monotonic_us() - slave->start_us) / 1000000;
+    return (unsigned char)(((slave->index + address + seconds) % 3) == 0);
+}
+static bool is_in_map(FARM_SLAVE * slave, unsigned int address, unsigned int count)
+{
+    return count > 0 && (size_t)address + count <= slave->register_count;
+}
+int farm_encode_exception(unsigned char * out, unsigned char function_code, unsigned char exception_code)
+{
+    out[0] = function_code | 0x80;
+    out[1] = exception_code;
+    return 2;
+}
+static int read_bits(FARM_SLAVE * slave, const unsigned char * pdu, unsigned char * out)
+{
+    unsigned int address = get_u16(pdu + 1);
+    unsigned int count = get_u16(pdu + 3);
+    unsigned int byte_count = (count + 7) / 8;
+
+    if (count == 0 || count > MAX_READ_BITS)
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_VALUE);
+    if (!is_in_map(slave, address, count))
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_ADDRESS);
+
+    out[0] = pdu[0];
+    out[1] = (unsigned char)byte_count;
+    memset(out + 2, 0, byte_count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        unsigned char bit = (pdu[0] == 1) ? slave->coils[address + i] : get_discrete_input(slave, address + i);
+        out[2 + i / 8] |= (unsigned char)(bit << (i % 8));
+    }
+    return 2 + byte_count;
+}
+static int read_registers(FARM_SLAVE * slave, const unsigned char * pdu, unsigned char * out)
+{
+    unsigned int address = get_u16(pdu + 1);
+    unsigned int count = get_u16(pdu + 3);
+
+    if (count == 0 || count > MAX_READ_REGISTERS)
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_VALUE);
+    if (!is_in_map(slave, address, count))
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_ADDRESS);
+
+    out[0] = pdu[0];
+    out[1] = (unsigned char)(count * 2);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        unsigned short value = (pdu[0] == 3) ? slave->holding_registers[address + i] : get_input_register(slave, address + i);
+        set_u16(out + 2 + i * 2, value);
+    }
+    return 2 + count * 2;
+}
+static int write_single(FARM_SLAVE * slave, const unsigned char * pdu, unsigned char * out)
+{
+    unsigned int address = get_u16(pdu + 1);
+    unsigned short value = get_u16(pdu + 3);
+
+    if (pdu[0] == 5 && value != 0xFF00 && value != 0)
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_VALUE);
+    if (!is_in_map(slave, address, 1))
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_ADDRESS);
+
+    if (pdu[0] == 5)
+        slave->coils[address] = (value == 0xFF00);
+    else
+        slave->holding_registers[address] = value;
+    //the response echoes the request
+    memcpy(out, pdu, 5);
+    return 5;
+}
+static int write_multiple(FARM_SLAVE * slave, const unsigned char * pdu, int pdu_len, unsigned char * out)
+{
+    unsigned int address = get_u16(pdu + 1);
+    unsigned int count = get_u16(pdu + 3);
+    unsigned int byte_count = (pdu[0] == 15) ? (count + 7) / 8 : count * 2;
+
+    if (pdu_len < 6 || count == 0 || count > ((pdu[0] == 15) ? MAX_WRITE_BITS : MAX_WRITE_REGISTERS) ||
+        pdu[5] != byte_count || pdu_len < 6 + (int)byte_count)
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_VALUE);
+    if (!is_in_map(slave, address, count))
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_ADDRESS);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (pdu[0] == 15)
+            slave->coils[address + i] = (pdu[6 + i / 8] >> (i % 8)) & 1;
+        else
+            slave->holding_registers[address + i] = get_u16(pdu + 6 + i * 2);
+    }
+    //the response echoes the address and the quantity
+    memcpy(out, pdu, 5);
+    return 5;
+}
+int farm_slave_init(FARM_SLAVE * slave, size_t index, size_t register_count, uint64_t start_us)
+{
+    slave->index = index;
+    slave->register_count = register_count;
+    slave->start_us = start_us;
+    slave->holding_registers = malloc(register_count * sizeof(unsigned short));
+    slave->coils = calloc(register_count, 1);
+    if (slave->holding_registers == NULL || slave->coils == NULL)
+    {
+        farm_slave_deinit(slave);
+        return -1;
+    }
+    for (size_t i = 0; i < register_count; i++)
+        slave->holding_registers[i] = (unsigned short)(index * 1000 + i);
+    return 0;
+}
+void farm_slave_deinit(FARM_SLAVE * slave)
+{
+    free(slave->holding_registers);
+    free(slave->coils);
+    slave->holding_registers = NULL;
+    slave->coils = NULL;
+}
+int farm_slave_answer(FARM_SLAVE * slave, const unsigned char * pdu, int pdu_len, unsigned char * out)
+{
+    switch ((pdu_len < 5) ? 0 : pdu[0])
+    {
+    case 0:
+        return farm_encode_exception(out, pdu[0], (pdu[0] >= 1 && pdu[0] <= 16) ? FARM_EXCEPTION_ILLEGAL_VALUE : FARM_EXCEPTION_ILLEGAL_FUNCTION);
+    case 1:
+    case 2:
+        return read_bits(slave, pdu, out);
+    case 3:
+    case 4:
+        return read_registers(slave, pdu, out);
+    case 5:
+    case 6:
+        return write_single(slave, pdu, out);
+    case 15:
+    case 16:
+        return write_multiple(slave, pdu, pdu_len, out);
+    default:
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_ILLEGAL_FUNCTION);
+    }
+}
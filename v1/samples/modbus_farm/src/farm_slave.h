@@ -0,0 +1,41 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef FARM_SLAVE_H
+#define FARM_SLAVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FARM_MAX_REGISTER_COUNT 65536
+
+#define FARM_EXCEPTION_ILLEGAL_FUNCTION 1
+#define FARM_EXCEPTION_ILLEGAL_ADDRESS 2
+#define FARM_EXCEPTION_ILLEGAL_VALUE 3
+#define FARM_EXCEPTION_DEVICE_FAILURE 4
+
+//the register map of a simulated slave: coils and holding registers keep what is written, input registers count up and discrete inputs toggle over time
+typedef struct FARM_SLAVE_TAG
+{
+    size_t index;
+    size_t register_count;
+    uint64_t start_us;
+    unsigned short * holding_registers;
+    unsigned char * coils;
+}FARM_SLAVE;
+
+extern uint64_t farm_get_monotonic_us(void);
+//the first xorshift32 state for a seed, never 0
+extern uint32_t farm_spread_seed(uint32_t seed);
+//index numbers the values of the slave, returns 0 or -1 if the map cannot be allocated
+extern int farm_slave_init(FARM_SLAVE * slave, size_t index, size_t register_count, uint64_t start_us);
+extern void farm_slave_deinit(FARM_SLAVE * slave);
+//answers a request PDU of function code 1 to 6, 15 or 16, returns the length of the response PDU put in out, which needs room for 253 bytes
+extern int farm_slave_answer(FARM_SLAVE * slave, const unsigned char * pdu, int pdu_len, unsigned char * out);
+extern int farm_encode_exception(unsigned char * out, unsigned char function_code, unsigned char exception_code);
+//appends the RTU crc to the len bytes of the frame, which needs room for 2 more
+extern void farm_set_crc(unsigned char * frame, size_t len);
+extern bool farm_is_crc_valid(const unsigned char * frame, size_t frame_len);
+
+#endif /*FARM_SLAVE_H*/
@@ -0,0 +1,674 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//a farm of simulated Modbus TCP slaves on loopback addresses, to load modbus_read without PLCs
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //accept4
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "farm_slave.h"
+
+#define DEFAULT_DEVICE_COUNT 10
+#define DEFAULT_FIRST_ADDRESS "127.1.0.1"
+//modbus_read always connects to the Modbus TCP port, so every slave gets its own loopback address rather than its own port
+#define DEFAULT_PORT 502
+#define DEFAULT_REGISTER_COUNT 100
+#define DEFAULT_READ_LENGTH 10
+#define DEFAULT_INTERVAL 1000
+#define MAX_EVENTS 256
+#define RX_BUFFER_SIZE 2048
+#define MBAP_LEN 7
+#define MAX_FRAME_LEN 260
+#define LISTENER_TAG ((uint64_t)1 << 63)
+
+typedef struct FARM_OPTIONS_TAG
+{
+    size_t device_count;
+    const char * first_address;
+    unsigned short port;
+    size_t register_count;
+    double latency_ms;
+    double jitter_ms;
+    double drop_rate;
+    double exception_rate;
+    unsigned int seed;
+    const char * config_path;
+    size_t interval;
+    size_t read_length;
+    size_t workers;
+    size_t max_in_flight;
+    size_t stats_interval;
+}FARM_OPTIONS;
+
+//one slave and the socket it listens on
+typedef struct FARM_DEVICE_TAG
+{
+    int listen_fd;
+    char address[INET_ADDRSTRLEN];
+    FARM_SLAVE slave;
+}FARM_DEVICE;
+
+typedef struct FARM_CONNECTION_TAG
+{
+    int fd;
+    unsigned int generation;
+    FARM_DEVICE * device;
+    unsigned char rx_buf[RX_BUFFER_SIZE];
+    size_t rx_len;
+}FARM_CONNECTION;
+
+//a response held back by the simulated latency, dropped if its connection went away meanwhile
+typedef struct FARM_RESPONSE_TAG
+{
+    uint64_t due_us;
+    size_t connection;
+    unsigned int generation;
+    int frame_len;
+    unsigned char frame[MAX_FRAME_LEN];
+}FARM_RESPONSE;
+
+typedef struct FARM_TAG
+{
+    FARM_OPTIONS options;
+    FARM_DEVICE * devices;
+    FARM_CONNECTION * connections;
+    size_t connection_count;
+    FARM_RESPONSE * responses;
+    size_t response_count;
+    size_t response_capacity;
+    int epoll_fd;
+    uint32_t random_state;
+    uint64_t start_us;
+    unsigned long long accepted;
+    unsigned long long requests;
+    unsigned long long dropped;
+    unsigned long long exceptions;
+}FARM;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int signal_number)
+{
+    (void)signal_number;
+    stopping = 1;
+}
+//xorshift32, seeded so that a run can be repeated
+static double get_random(FARM * farm)
+{
+    uint32_t x = farm->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    farm->random_state = x;
+    return (double)x / 4294967296.0;
+}
+static unsigned short get_u16(const unsigned char * buf)
+{
+    return (unsigned short)((buf[0] << 8) | buf[1]);
+}
+static void set_u16(unsigned char * buf, unsigned short value)
+{
+    buf[0] = (unsigned char)(value >> 8);
+    buf[1] = (unsigned char)(value & 0xFF);
+}
+//encodes the response PDU into out and returns its length
+static int build_response(FARM * farm, FARM_DEVICE * device, const unsigned char * pdu, int pdu_len, unsigned char * out)
+{
+    if (farm->options.exception_rate > 0 && get_random(farm) < farm->options.exception_rate)
+        return farm_encode_exception(out, pdu[0], FARM_EXCEPTION_DEVICE_FAILURE);
+    return farm_slave_answer(&device->slave, pdu, pdu_len, out);
+}
+static void close_connection(FARM_CONNECTION * connection)
+{
+    //a closed descriptor leaves the epoll set, the responses still held for it are dropped by the generation check
+    close(connection->fd);
+    connection->fd = -1;
+    connection->generation++;
+    connection->rx_len = 0;
+}
+static int send_frame(FARM_CONNECTION * connection, const unsigned char * frame, int frame_len)
+{
+    //a loopback socket takes a whole frame, a short write means the client stopped reading
+    if (send(connection->fd, frame, frame_len, MSG_NOSIGNAL) != frame_len)
+    {
+        close_connection(connection);
+        return -1;
+    }
+    return 0;
+}
+static void schedule_sift_up(FARM_RESPONSE * heap, size_t index)
+{
+    while (index > 0 && heap[(index - 1) / 2].due_us > heap[index].due_us)
+    {
+        FARM_RESPONSE swap = heap[index];
+        heap[index] = heap[(index - 1) / 2];
+        heap[(index - 1) / 2] = swap;
+        index = (index - 1) / 2;
+    }
+}
+static void schedule_sift_down(FARM_RESPONSE * heap, size_t count, size_t index)
+{
+    while (1)
+    {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        if (left < count && heap[left].due_us < heap[smallest].due_us)
+            smallest = left;
+        if (left + 1 < count && heap[left + 1].due_us < heap[smallest].due_us)
+            smallest = left + 1;
+        if (smallest == index)
+            return;
+        FARM_RESPONSE swap = heap[index];
+        heap[index] = heap[smallest];
+        heap[smallest] = swap;
+        index = smallest;
+    }
+}
+static FARM_RESPONSE * add_response(FARM * farm)
+{
+    if (farm->response_count == farm->response_capacity)
+    {
+        size_t capacity = (farm->response_capacity == 0) ? 256 : farm->response_capacity * 2;
+        FARM_RESPONSE * responses = realloc(farm->responses, capacity * sizeof(FARM_RESPONSE));
+        if (responses == NULL)
+            return NULL;
+        farm->responses = responses;
+        farm->response_capacity = capacity;
+    }
+    return &farm->responses[farm->response_count++];
+}
+static uint64_t get_latency_us(FARM * farm)
+{
+    double latency_ms = farm->options.latency_ms;
+    if (farm->options.jitter_ms > 0)
+        latency_ms += farm->options.jitter_ms * (2 * get_random(farm) - 1);
+    return (latency_ms > 0) ? (uint64_t)(latency_ms * 1000) : 0;
+}
+static void answer_request(FARM * farm, size_t connection_i, const unsigned char * request, int request_len)
+{
+    FARM_CONNECTION * connection = &farm->connections[connection_i];
+    unsigned char frame[MAX_FRAME_LEN];
+    uint64_t latency_us;
+    int pdu_len;
+
+    farm->requests++;
+    if (farm->options.drop_rate > 0 && get_random(farm) < farm->options.drop_rate)
+    {
+        farm->dropped++;
+        return;
+    }
+    pdu_len = build_response(farm, connection->device, request + MBAP_LEN, request_len - MBAP_LEN, frame + MBAP_LEN);
+    if (frame[MBAP_LEN] & 0x80)
+        farm->exceptions++;
+    //transaction and unit id are echoed
+    memcpy(frame, request, 4);
+    set_u16(frame + 4, (unsigned short)(pdu_len + 1));
+    frame[6] = request[6];
+
+    latency_us = get_latency_us(farm);
+    if (latency_us == 0)
+    {
+        (void)send_frame(connection, frame, MBAP_LEN + pdu_len);
+    }
+    else
+    {
+        FARM_RESPONSE * response = add_response(farm);
+        if (response == NULL)
+        {
+            farm->dropped++;
+            return;
+        }
+        response->due_us = farm_get_monotonic_us() + latency_us;
+        response->connection = connection_i;
+        response->generation = connection->generation;
+        response->frame_len = MBAP_LEN + pdu_len;
+        memcpy(response->frame, frame, response->frame_len);
+        schedule_sift_up(farm->responses, farm->response_count - 1);
+    }
+}
+static void send_due_responses(FARM * farm)
+{
+    uint64_t now = farm_get_monotonic_us();
+    while (farm->response_count > 0 && farm->responses[0].due_us <= now)
+    {
+        FARM_RESPONSE * response = &farm->responses[0];
+        FARM_CONNECTION * connection = &farm->connections[response->connection];
+        if (connection->fd != -1 && connection->generation == response->generation)
+            (void)send_frame(connection, response->frame, response->frame_len);
+        farm->responses[0] = farm->responses[--farm->response_count];
+        schedule_sift_down(farm->responses, farm->response_count, 0);
+    }
+}
+//answers every complete frame buffered, pipelined requests included
+static void on_connection_readable(FARM * farm, size_t connection_i)
+{
+    FARM_CONNECTION * connection = &farm->connections[connection_i];
+    while (connection->fd != -1)
+    {
+        ssize_t recv_size = recv(connection->fd, connection->rx_buf + connection->rx_len, sizeof(connection->rx_buf) - connection->rx_len, 0);
+        if (recv_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return;
+        if (recv_size <= 0)
+        {
+            close_connection(connection);
+            return;
+        }
+        connection->rx_len += recv_size;
+
+        size_t offset = 0;
+        while (connection->rx_len - offset >= 6)
+        {
+            unsigned char * frame = connection->rx_buf + offset;
+            size_t frame_len = (size_t)get_u16(frame + 4) + 6;
+            if (get_u16(frame + 2) != 0 || frame_len < MBAP_LEN + 1 || frame_len > MAX_FRAME_LEN)
+            {
+                fprintf(stderr, "invalid MBAP header from a client of %s, closing\n", connection->device->address);
+                close_connection(connection);
+                return;
+            }
+            if (connection->rx_len - offset < frame_len)
+                break;
+            answer_request(farm, connection_i, frame, (int)frame_len);
+            if (connection->fd == -1)
+                return;
+            offset += frame_len;
+        }
+        connection->rx_len -= offset;
+        memmove(connection->rx_buf, connection->rx_buf + offset, connection->rx_len);
+    }
+}
+static FARM_CONNECTION * get_free_connection(FARM * farm, size_t * connection_i)
+{
+    for (size_t i = 0; i < farm->connection_count; i++)
+    {
+        if (farm->connections[i].fd == -1)
+        {
+            *connection_i = i;
+            return &farm->connections[i];
+        }
+    }
+    size_t capacity = (farm->connection_count == 0) ? 64 : farm->connection_count * 2;
+    FARM_CONNECTION * connections = realloc(farm->connections, capacity * sizeof(FARM_CONNECTION));
+    if (connections == NULL)
+        return NULL;
+    for (size_t i = farm->connection_count; i < capacity; i++)
+    {
+        connections[i].fd = -1;
+        connections[i].generation = 0;
+    }
+    farm->connections = connections;
+    *connection_i = farm->connection_count;
+    farm->connection_count = capacity;
+    return &farm->connections[*connection_i];
+}
+static void on_listener_readable(FARM * farm, FARM_DEVICE * device)
+{
+    int fd;
+    while ((fd = accept4(device->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+    {
+        size_t connection_i;
+        int no_delay = 1;
+        struct epoll_event event;
+        FARM_CONNECTION * connection = get_free_connection(farm, &connection_i);
+        if (connection == NULL)
+        {
+            fprintf(stderr, "unable to malloc a connection of %s\n", device->address);
+            close(fd);
+            continue;
+        }
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+        connection->fd = fd;
+        connection->device = device;
+        connection->rx_len = 0;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = connection_i;
+        if (epoll_ctl(farm->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            fprintf(stderr, "epoll_ctl failed for a client of %s\n", device->address);
+            close_connection(connection);
+            continue;
+        }
+        farm->accepted++;
+    }
+}
+//one listening socket per slave, on consecutive loopback addresses that skip the .0 and .255 hosts
+static int open_devices(FARM * farm)
+{
+    struct in_addr address;
+    if (inet_pton(AF_INET, farm->options.first_address, &address) != 1)
+    {
+        fprintf(stderr, "invalid address %s\n", farm->options.first_address);
+        return -1;
+    }
+    uint32_t host = ntohl(address.s_addr);
+
+    farm->devices = calloc(farm->options.device_count, sizeof(FARM_DEVICE));
+    if (farm->devices == NULL)
+        return -1;
+    for (size_t device_i = 0; device_i < farm->options.device_count; device_i++)
+    {
+        FARM_DEVICE * device = &farm->devices[device_i];
+        struct sockaddr_in server;
+        struct epoll_event event;
+        int reuse = 1;
+
+        while ((host & 0xFF) == 0 || (host & 0xFF) == 0xFF)
+            host++;
+        address.s_addr = htonl(host++);
+        (void)inet_ntop(AF_INET, &address, device->address, sizeof(device->address));
+
+        device->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (farm_slave_init(&device->slave, device_i, farm->options.register_count, farm->start_us) != 0 || device->listen_fd == -1)
+        {
+            fprintf(stderr, "unable to create slave %s\n", device->address);
+            return -1;
+        }
+
+        memset(&server, 0, sizeof(server));
+        server.sin_family = AF_INET;
+        server.sin_addr = address;
+        server.sin_port = htons(farm->options.port);
+        (void)setsockopt(device->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(device->listen_fd, (struct sockaddr *)&server, sizeof(server)) != 0 || listen(device->listen_fd, 64) != 0)
+        {
+            fprintf(stderr, "unable to listen on %s:%u: %s\n", device->address, farm->options.port, strerror(errno));
+            return -1;
+        }
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = LISTENER_TAG | device_i;
+        if (epoll_ctl(farm->epoll_fd, EPOLL_CTL_ADD, device->listen_fd, &event) != 0)
+        {
+            fprintf(stderr, "epoll_ctl failed for slave %s\n", device->address);
+            return -1;
+        }
+    }
+    return 0;
+}
+static void close_devices(FARM * farm)
+{
+    for (size_t i = 0; i < farm->connection_count; i++)
+    {
+        if (farm->connections[i].fd != -1)
+            close(farm->connections[i].fd);
+    }
+    for (size_t device_i = 0; farm->devices != NULL && device_i < farm->options.device_count; device_i++)
+    {
+        if (farm->devices[device_i].listen_fd > 0)
+            close(farm->devices[device_i].listen_fd);
+        farm_slave_deinit(&farm->devices[device_i].slave);
+    }
+    free(farm->devices);
+    free(farm->connections);
+    free(farm->responses);
+}
+//the locally administered mac address 02:00:00:xx:xx:xx numbers the slaves for the gateway
+static void write_server_config(FARM * farm, FILE * file, size_t device_i)
+{
+    const FARM_OPTIONS * options = &farm->options;
+    static const unsigned char function_codes[] = { 3, 4, 1, 2 };
+
+    fprintf(file, "          {\n");
+    fprintf(file, "            \"serverConnectionString\": \"%s\",\n", farm->devices[device_i].address);
+    fprintf(file, "            \"interval\": \"%zu\",\n", options->interval);
+    fprintf(file, "            \"macAddress\": \"02:00:00:%02X:%02X:%02X\",\n", (unsigned int)((device_i >> 16) & 0xFF), (unsigned int)((device_i >> 8) & 0xFF), (unsigned int)(device_i & 0xFF));
+    fprintf(file, "            \"deviceType\": \"farmDevice\",\n");
+    fprintf(file, "            \"sqliteEnabled\": \"0\",\n");
+    fprintf(file, "            \"maxInFlight\": \"%zu\",\n", options->max_in_flight);
+    if (options->stats_interval > 0)
+        fprintf(file, "            \"statsInterval\": \"%zu\",\n", options->stats_interval);
+    fprintf(file, "            \"operations\": [\n");
+    for (size_t i = 0; i < sizeof(function_codes); i++)
+    {
+        fprintf(file, "              {\n");
+        fprintf(file, "                \"unitId\": \"1\",\n");
+        fprintf(file, "                \"functionCode\": \"%u\",\n", function_codes[i]);
+        fprintf(file, "                \"startingAddress\": \"1\",\n");
+        fprintf(file, "                \"length\": \"%zu\"\n", options->read_length);
+        fprintf(file, "              }%s\n", (i + 1 < sizeof(function_codes)) ? "," : "");
+    }
+    fprintf(file, "            ]\n");
+    fprintf(file, "          }%s\n", (device_i + 1 < options->device_count) ? "," : "");
+}
+//a gateway config in the layout of modbus_lin.json that polls every slave of the farm and logs the telemetry
+static int write_gateway_config(FARM * farm)
+{
+    FILE * file = fopen(farm->options.config_path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "unable to open %s\n", farm->options.config_path);
+        return -1;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"modules\": [\n");
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"name\": \"logger\",\n");
+    fprintf(file, "      \"loader\": {\n");
+    fprintf(file, "        \"name\": \"native\",\n");
+    fprintf(file, "        \"entrypoint\": {\n");
+    fprintf(file, "          \"module.path\": \"../../modules/logger/liblogger.so\"\n");
+    fprintf(file, "        }\n");
+    fprintf(file, "      },\n");
+    fprintf(file, "      \"args\": {\n");
+    fprintf(file, "        \"filename\": \"log.txt\"\n");
+    fprintf(file, "      }\n");
+    fprintf(file, "    },\n");
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"name\": \"modbus_read\",\n");
+    fprintf(file, "      \"loader\": {\n");
+    fprintf(file, "        \"name\": \"native\",\n");
+    fprintf(file, "        \"entrypoint\": {\n");
+    fprintf(file, "          \"module.path\": \"../../modules/modbus_read/libmodbus_read.so\"\n");
+    fprintf(file, "        }\n");
+    fprintf(file, "      },\n");
+    fprintf(file, "      \"args\": {\n");
+    fprintf(file, "        \"workers\": \"%zu\",\n", farm->options.workers);
+    fprintf(file, "        \"servers\": [\n");
+    for (size_t device_i = 0; device_i < farm->options.device_count; device_i++)
+        write_server_config(farm, file, device_i);
+    fprintf(file, "        ]\n");
+    fprintf(file, "      }\n");
+    fprintf(file, "    }\n");
+    fprintf(file, "  ],\n");
+    fprintf(file, "  \"links\": [\n");
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"source\": \"modbus_read\",\n");
+    fprintf(file, "      \"sink\": \"logger\"\n");
+    fprintf(file, "    }\n");
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "unable to write %s\n", farm->options.config_path);
+        return -1;
+    }
+    return 0;
+}
+//every slave takes a listening socket and a connection
+static void raise_file_limit(size_t device_count)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        (void)setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < 2 * device_count + 16)
+    {
+        fprintf(stderr, "warning: %llu descriptors allowed, %zu slaves and their clients need %zu\n", (unsigned long long)limit.rlim_cur, device_count, 2 * device_count + 16);
+    }
+}
+static void run_farm(FARM * farm)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!stopping)
+    {
+        int wait_ms = -1;
+        if (farm->response_count > 0)
+        {
+            uint64_t now = farm_get_monotonic_us();
+            uint64_t due = farm->responses[0].due_us;
+            wait_ms = (due > now) ? (int)((due - now + 999) / 1000) : 0;
+        }
+        int event_count = epoll_wait(farm->epoll_fd, events, MAX_EVENTS, wait_ms);
+        if (event_count < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "epoll_wait failed: %s\n", strerror(errno));
+            return;
+        }
+        for (int event_i = 0; event_i < event_count; event_i++)
+        {
+            uint64_t tag = events[event_i].data.u64;
+            if (tag & LISTENER_TAG)
+                on_listener_readable(farm, &farm->devices[tag & ~LISTENER_TAG]);
+            else
+                on_connection_readable(farm, (size_t)tag);
+        }
+        send_due_responses(farm);
+    }
+}
+static void print_usage(const char * program)
+{
+    printf("usage: %s [options]\n", program);
+    printf("  --devices N          simulated slaves, default %d\n", DEFAULT_DEVICE_COUNT);
+    printf("  --address A          loopback address of the first slave, default %s\n", DEFAULT_FIRST_ADDRESS);
+    printf("  --port P             port of every slave, default %d (the port modbus_read connects to)\n", DEFAULT_PORT);
+    printf("  --registers N        coils, discrete inputs, input and holding registers of each slave, default %d\n", DEFAULT_REGISTER_COUNT);
+    printf("  --latency MS         mean response latency, default 0\n");
+    printf("  --jitter MS          the latency varies evenly by up to this much either way, default 0\n");
+    printf("  --drop RATE          share of the requests left unanswered, 0 to 1, default 0\n");
+    printf("  --exceptions RATE    share of the requests answered with exception 4, 0 to 1, default 0\n");
+    printf("  --seed N             seed of the drops, exceptions and jitter, default 1\n");
+    printf("  --config FILE        write a gateway config polling every slave, then serve\n");
+    printf("  --interval MS        poll interval of the config, default %d\n", DEFAULT_INTERVAL);
+    printf("  --read-length N      cells per read operation of the config, default %d\n", DEFAULT_READ_LENGTH);
+    printf("  --workers N          poll workers of the config, default 1\n");
+    printf("  --max-in-flight N    maxInFlight of the config, default 1\n");
+    printf("  --stats-interval MS  statsInterval of the config, default none\n");
+}
+static int parse_options(int argc, char ** argv, FARM_OPTIONS * options)
+{
+    static const struct option long_options[] =
+    {
+        { "devices", required_argument, NULL, 'n' },
+        { "address", required_argument, NULL, 'a' },
+        { "port", required_argument, NULL, 'p' },
+        { "registers", required_argument, NULL, 'r' },
+        { "latency", required_argument, NULL, 'l' },
+        { "jitter", required_argument, NULL, 'j' },
+        { "drop", required_argument, NULL, 'd' },
+        { "exceptions", required_argument, NULL, 'e' },
+        { "seed", required_argument, NULL, 's' },
+        { "config", required_argument, NULL, 'c' },
+        { "interval", required_argument, NULL, 'i' },
+        { "read-length", required_argument, NULL, 'L' },
+        { "workers", required_argument, NULL, 'w' },
+        { "max-in-flight", required_argument, NULL, 'm' },
+        { "stats-interval", required_argument, NULL, 'S' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option;
+
+    options->device_count = DEFAULT_DEVICE_COUNT;
+    options->first_address = DEFAULT_FIRST_ADDRESS;
+    options->port = DEFAULT_PORT;
+    options->register_count = DEFAULT_REGISTER_COUNT;
+    options->latency_ms = 0;
+    options->jitter_ms = 0;
+    options->drop_rate = 0;
+    options->exception_rate = 0;
+    options->seed = 1;
+    options->config_path = NULL;
+    options->interval = DEFAULT_INTERVAL;
+    options->read_length = DEFAULT_READ_LENGTH;
+    options->workers = 1;
+    options->max_in_flight = 1;
+    options->stats_interval = 0;
+
+    while ((option = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'n': options->device_count = strtoul(optarg, NULL, 10); break;
+        case 'a': options->first_address = optarg; break;
+        case 'p': options->port = (unsigned short)strtoul(optarg, NULL, 10); break;
+        case 'r': options->register_count = strtoul(optarg, NULL, 10); break;
+        case 'l': options->latency_ms = atof(optarg); break;
+        case 'j': options->jitter_ms = atof(optarg); break;
+        case 'd': options->drop_rate = atof(optarg); break;
+        case 'e': options->exception_rate = atof(optarg); break;
+        case 's': options->seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'c': options->config_path = optarg; break;
+        case 'i': options->interval = strtoul(optarg, NULL, 10); break;
+        case 'L': options->read_length = strtoul(optarg, NULL, 10); break;
+        case 'w': options->workers = strtoul(optarg, NULL, 10); break;
+        case 'm': options->max_in_flight = strtoul(optarg, NULL, 10); break;
+        case 'S': options->stats_interval = strtoul(optarg, NULL, 10); break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (options->device_count == 0 || options->register_count == 0 || options->register_count > FARM_MAX_REGISTER_COUNT ||
+        options->read_length == 0 || options->read_length > options->register_count || options->workers == 0 || options->max_in_flight == 0)
+    {
+        fprintf(stderr, "invalid options, the read length must be within the register map\n");
+        return -1;
+    }
+    return 0;
+}
+int main(int argc, char ** argv)
+{
+    FARM farm;
+    int result = 1;
+
+    memset(&farm, 0, sizeof(farm));
+    if (parse_options(argc, argv, &farm.options) != 0)
+        return 1;
+    farm.random_state = farm_spread_seed(farm.options.seed);
+    farm.start_us = farm_get_monotonic_us();
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    raise_file_limit(farm.options.device_count);
+
+    farm.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (farm.epoll_fd == -1)
+    {
+        fprintf(stderr, "epoll_create1 failed\n");
+    }
+    else
+    {
+        if (open_devices(&farm) == 0 && (farm.options.config_path == NULL || write_gateway_config(&farm) == 0))
+        {
+            printf("%zu slaves listening on %s to %s port %u\n", farm.options.device_count, farm.devices[0].address,
+                farm.devices[farm.options.device_count - 1].address, farm.options.port);
+            fflush(stdout);
+            run_farm(&farm);
+            printf("%llu connections, %llu requests, %llu dropped, %llu exceptions\n", farm.accepted, farm.requests, farm.dropped, farm.exceptions);
+            result = 0;
+        }
+        close_devices(&farm);
+        close(farm.epoll_fd);
+    }
+    return result;
+}
@@ -0,0 +1,643 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//a Modbus RTU bus of simulated slaves behind a pseudo-terminal, to load the serial path of modbus_read without a serial port
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //ppoll
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <sys/stat.h>
+
+#include "farm_slave.h"
+
+#define DEFAULT_UNIT_COUNT 4
+#define DEFAULT_BAUD_RATE 9600
+#define DEFAULT_REGISTER_COUNT 100
+#define DEFAULT_READ_LENGTH 10
+#define DEFAULT_INTERVAL 1000
+#define DEFAULT_TURNAROUND_MS 5
+//bytes handed to the master at once, the size of a common UART FIFO
+#define DEFAULT_CHUNK 16
+#define MAX_UNIT_COUNT 247
+#define MAX_FRAME_LEN 256
+#define MIN_FRAME_LEN 4
+#define BROADCAST_UNIT 0
+
+typedef struct BUS_OPTIONS_TAG
+{
+    size_t unit_count;
+    size_t register_count;
+    unsigned int baud_rate;
+    unsigned int data_bits;
+    char parity;
+    unsigned int stop_bits;
+    double turnaround_ms;
+    double jitter_ms;
+    double drop_rate;
+    double exception_rate;
+    double noise_rate;
+    double crc_error_rate;
+    size_t chunk;
+    unsigned int seed;
+    const char * link_path;
+    const char * config_path;
+    size_t interval;
+    size_t read_length;
+}BUS_OPTIONS;
+
+typedef struct BUS_TAG
+{
+    BUS_OPTIONS options;
+    FARM_SLAVE * slaves;
+    int master_fd;
+    int slave_fd;
+    char slave_name[64];
+    bool linked;
+    uint32_t random_state;
+    uint64_t start_us;
+    uint64_t char_us;
+    uint64_t gap_us;
+    uint64_t char_gap_us;
+    //request being received, the bytes of a read are taken to go over the line from when they are read, after the bytes before them
+    unsigned char rx_frame[MAX_FRAME_LEN];
+    size_t rx_len;
+    uint64_t rx_line_end_us;
+    bool rx_broken;
+    //response on the line, one at a time as on a half-duplex bus
+    unsigned char tx_frame[MAX_FRAME_LEN];
+    size_t tx_len;
+    size_t tx_sent;
+    uint64_t tx_start_us;
+    unsigned long long requests;
+    unsigned long long responses;
+    unsigned long long broadcasts;
+    unsigned long long unaddressed;
+    unsigned long long bad_requests;
+    unsigned long long gap_violations;
+    unsigned long long collisions;
+    unsigned long long dropped;
+    unsigned long long exceptions;
+    unsigned long long noise;
+    unsigned long long crc_errors;
+}BUS;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int signal_number)
+{
+    (void)signal_number;
+    stopping = 1;
+}
+//xorshift32, seeded so that a run can be repeated
+static double get_random(BUS * bus)
+{
+    uint32_t x = bus->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    bus->random_state = x;
+    return (double)x / 4294967296.0;
+}
+static bool happens(BUS * bus, double rate)
+{
+    return rate > 0 && get_random(bus) < rate;
+}
+//the same character time and frame gaps as modbus_read: 1.5 and 3.5 characters, fixed at 750us and 1750us above 19200 baud
+static void set_line_timing(BUS * bus)
+{
+    const BUS_OPTIONS * options = &bus->options;
+    unsigned int char_bits = 1 + options->data_bits + ((options->parity == 'N') ? 0 : 1) + options->stop_bits;
+
+    bus->char_us = (uint64_t)char_bits * 1000000 / options->baud_rate;
+    if (options->baud_rate > 19200)
+    {
+        bus->gap_us = 1750;
+        bus->char_gap_us = 750;
+    }
+    else
+    {
+        bus->gap_us = ((uint64_t)char_bits * 3500000 + options->baud_rate - 1) / options->baud_rate;
+        bus->char_gap_us = ((uint64_t)char_bits * 1500000 + options->baud_rate - 1) / options->baud_rate;
+    }
+}
+static uint64_t get_turnaround_us(BUS * bus)
+{
+    double turnaround_ms = bus->options.turnaround_ms;
+    if (bus->options.jitter_ms > 0)
+        turnaround_ms += bus->options.jitter_ms * (2 * get_random(bus) - 1);
+    return (turnaround_ms > 0) ? (uint64_t)(turnaround_ms * 1000) : 0;
+}
+static bool is_write(unsigned char function_code)
+{
+    return function_code == 5 || function_code == 6 || function_code == 15 || function_code == 16;
+}
+//noise flips one bit anywhere in the frame, a crc error spoils the checksum only
+static void corrupt_response(BUS * bus)
+{
+    if (happens(bus, bus->options.noise_rate))
+    {
+        size_t byte = (size_t)(get_random(bus) * bus->tx_len);
+        bus->tx_frame[byte] ^= (unsigned char)(1 << (int)(get_random(bus) * 8));
+        bus->noise++;
+    }
+    else if (happens(bus, bus->options.crc_error_rate))
+    {
+        bus->tx_frame[bus->tx_len - 1] ^= 0xFF;
+        bus->crc_errors++;
+    }
+}
+static void answer_request(BUS * bus)
+{
+    unsigned char * request = bus->rx_frame;
+    size_t request_len = bus->rx_len;
+    unsigned char unit = request[0];
+    int pdu_len;
+
+    if (bus->rx_broken || request_len < MIN_FRAME_LEN || !farm_is_crc_valid(request, request_len))
+    {
+        //a slave stays silent on a frame it cannot trust
+        bus->bad_requests++;
+        return;
+    }
+    bus->requests++;
+    if (unit == BROADCAST_UNIT)
+    {
+        //every slave applies a broadcast write and none answers
+        unsigned char ignored[MAX_FRAME_LEN];
+        if (is_write(request[1]))
+        {
+            for (size_t i = 0; i < bus->options.unit_count; i++)
+                (void)farm_slave_answer(&bus->slaves[i], request + 1, (int)request_len - 3, ignored);
+        }
+        bus->broadcasts++;
+        return;
+    }
+    if (unit > bus->options.unit_count)
+    {
+        bus->unaddressed++;
+        return;
+    }
+    if (happens(bus, bus->options.drop_rate))
+    {
+        bus->dropped++;
+        return;
+    }
+
+    if (happens(bus, bus->options.exception_rate))
+        pdu_len = farm_encode_exception(bus->tx_frame + 1, request[1], FARM_EXCEPTION_DEVICE_FAILURE);
+    else
+        pdu_len = farm_slave_answer(&bus->slaves[unit - 1], request + 1, (int)request_len - 3, bus->tx_frame + 1);
+    if (bus->tx_frame[1] & 0x80)
+        bus->exceptions++;
+    bus->tx_frame[0] = unit;
+    farm_set_crc(bus->tx_frame, 1 + pdu_len);
+    bus->tx_len = 1 + pdu_len + 2;
+    bus->tx_sent = 0;
+    corrupt_response(bus);
+    //the slave hears the end of the request once the line stayed silent for 3.5 characters
+    bus->tx_start_us = bus->rx_line_end_us + bus->gap_us + get_turnaround_us(bus);
+    bus->responses++;
+}
+//a request ends with 3.5 characters of silence
+static void end_request_if_silent(BUS * bus, uint64_t now)
+{
+    if (bus->rx_len > 0 && now >= bus->rx_line_end_us + bus->gap_us)
+    {
+        answer_request(bus);
+        bus->rx_len = 0;
+        bus->rx_broken = false;
+    }
+}
+static void on_master_readable(BUS * bus)
+{
+    unsigned char buf[MAX_FRAME_LEN];
+    ssize_t read_size;
+
+    while ((read_size = read(bus->master_fd, buf, sizeof(buf))) > 0)
+    {
+        uint64_t now = farm_get_monotonic_us();
+
+        end_request_if_silent(bus, now);
+        if (bus->tx_len > 0)
+        {
+            //the master talks over a response: both frames are lost on a shared line
+            bus->collisions++;
+            bus->tx_len = 0;
+            bus->rx_broken = true;
+        }
+        if (bus->rx_len > 0 && now > bus->rx_line_end_us + bus->char_gap_us)
+        {
+            //a pause of more than 1.5 characters inside a frame
+            bus->gap_violations++;
+            bus->rx_broken = true;
+        }
+        if (bus->rx_len == 0 || now > bus->rx_line_end_us)
+            bus->rx_line_end_us = now;
+        bus->rx_line_end_us += read_size * bus->char_us;
+        for (ssize_t i = 0; i < read_size; i++)
+        {
+            if (bus->rx_len < MAX_FRAME_LEN)
+                bus->rx_frame[bus->rx_len++] = buf[i];
+            else
+                bus->rx_broken = true;
+        }
+    }
+}
+static size_t get_chunk_len(BUS * bus)
+{
+    size_t chunk = bus->tx_len - bus->tx_sent;
+    return (chunk > bus->options.chunk) ? bus->options.chunk : chunk;
+}
+//a chunk reaches the master once its last byte went over the line
+static uint64_t get_chunk_due_us(BUS * bus)
+{
+    return bus->tx_start_us + (bus->tx_sent + get_chunk_len(bus)) * bus->char_us;
+}
+//the response goes out a receive FIFO at a time, paced at the baud rate
+static void send_due_response(BUS * bus, uint64_t now)
+{
+    while (bus->tx_len > 0 && now >= get_chunk_due_us(bus))
+    {
+        size_t chunk = get_chunk_len(bus);
+        ssize_t written = write(bus->master_fd, bus->tx_frame + bus->tx_sent, chunk);
+        if (written < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        if (written <= 0)
+        {
+            //nobody holds the terminal open
+            bus->tx_len = 0;
+            return;
+        }
+        bus->tx_sent += written;
+        if (bus->tx_sent == bus->tx_len)
+            bus->tx_len = 0;
+    }
+}
+static uint64_t get_next_due_us(BUS * bus)
+{
+    uint64_t due = UINT64_MAX;
+    if (bus->rx_len > 0)
+        due = bus->rx_line_end_us + bus->gap_us;
+    if (bus->tx_len > 0 && get_chunk_due_us(bus) < due)
+        due = get_chunk_due_us(bus);
+    return due;
+}
+static void run_bus(BUS * bus)
+{
+    struct pollfd poll_fd;
+
+    poll_fd.fd = bus->master_fd;
+    poll_fd.events = POLLIN;
+    while (!stopping)
+    {
+        uint64_t due = get_next_due_us(bus);
+        uint64_t now = farm_get_monotonic_us();
+        struct timespec timeout;
+        struct timespec * timeout_p = NULL;
+
+        //the frame gaps are under 2ms at high baud rates, past the resolution of poll
+        if (due != UINT64_MAX)
+        {
+            uint64_t wait_us = (due > now) ? due - now : 0;
+            timeout.tv_sec = (time_t)(wait_us / 1000000);
+            timeout.tv_nsec = (long)(wait_us % 1000000) * 1000;
+            timeout_p = &timeout;
+        }
+        poll_fd.revents = 0;
+        if (ppoll(&poll_fd, 1, timeout_p, NULL) < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "ppoll failed: %s\n", strerror(errno));
+            return;
+        }
+        if (poll_fd.revents & POLLIN)
+            on_master_readable(bus);
+        now = farm_get_monotonic_us();
+        end_request_if_silent(bus, now);
+        send_due_response(bus, now);
+    }
+}
+//a symlink may be replaced, a real serial device never is
+static int link_terminal(BUS * bus)
+{
+    struct stat link_stat;
+    const char * path = bus->options.link_path;
+
+    if (lstat(path, &link_stat) == 0)
+    {
+        if (!S_ISLNK(link_stat.st_mode))
+        {
+            fprintf(stderr, "%s exists and is not a symlink, pick a free COM port\n", path);
+            return -1;
+        }
+        if (unlink(path) != 0)
+        {
+            fprintf(stderr, "unable to remove %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+    if (symlink(bus->slave_name, path) != 0)
+    {
+        fprintf(stderr, "unable to link %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    bus->linked = true;
+    return 0;
+}
+static int open_bus(BUS * bus)
+{
+    struct termios settings;
+    int flags;
+
+    bus->slaves = calloc(bus->options.unit_count, sizeof(FARM_SLAVE));
+    if (bus->slaves == NULL)
+        return -1;
+    for (size_t i = 0; i < bus->options.unit_count; i++)
+    {
+        if (farm_slave_init(&bus->slaves[i], i, bus->options.register_count, bus->start_us) != 0)
+        {
+            fprintf(stderr, "unable to create unit %zu\n", i + 1);
+            return -1;
+        }
+    }
+    if (openpty(&bus->master_fd, &bus->slave_fd, bus->slave_name, NULL, NULL) != 0)
+    {
+        fprintf(stderr, "openpty failed: %s\n", strerror(errno));
+        return -1;
+    }
+    //the terminal keeps its own end open, so the master side does not fail between two clients
+    if (tcgetattr(bus->slave_fd, &settings) == 0)
+    {
+        cfmakeraw(&settings);
+        (void)tcsetattr(bus->slave_fd, TCSANOW, &settings);
+    }
+    flags = fcntl(bus->master_fd, F_GETFL);
+    if (flags == -1 || fcntl(bus->master_fd, F_SETFL, flags | O_NONBLOCK) != 0)
+    {
+        fprintf(stderr, "unable to make the terminal non-blocking\n");
+        return -1;
+    }
+    if (bus->options.link_path != NULL)
+        return link_terminal(bus);
+    return 0;
+}
+static void close_bus(BUS * bus)
+{
+    if (bus->linked)
+        (void)unlink(bus->options.link_path);
+    if (bus->master_fd > 0)
+        close(bus->master_fd);
+    if (bus->slave_fd > 0)
+        close(bus->slave_fd);
+    for (size_t i = 0; bus->slaves != NULL && i < bus->options.unit_count; i++)
+        farm_slave_deinit(&bus->slaves[i]);
+    free(bus->slaves);
+}
+//modbus_read opens COMn as /dev/ttyS(n-1)
+static int get_com_port(const char * link_path)
+{
+    const char * prefix = "/dev/ttyS";
+    if (link_path == NULL || strncmp(link_path, prefix, strlen(prefix)) != 0)
+        return -1;
+    return atoi(link_path + strlen(prefix)) + 1;
+}
+static void write_server_config(BUS * bus, FILE * file, int com_port, size_t unit_i)
+{
+    const BUS_OPTIONS * options = &bus->options;
+    static const unsigned char function_codes[] = { 3, 4, 1, 2 };
+    static const char * parity_names[] = { "NONE", "ODD", "EVEN" };
+    const char * parity = parity_names[(options->parity == 'N') ? 0 : (options->parity == 'O') ? 1 : 2];
+
+    fprintf(file, "          {\n");
+    fprintf(file, "            \"serverConnectionString\": \"COM%d\",\n", com_port);
+    fprintf(file, "            \"interval\": \"%zu\",\n", options->interval);
+    fprintf(file, "            \"macAddress\": \"02:00:01:00:00:%02X\",\n", (unsigned int)(unit_i + 1));
+    fprintf(file, "            \"deviceType\": \"rtuDevice\",\n");
+    fprintf(file, "            \"sqliteEnabled\": \"0\",\n");
+    fprintf(file, "            \"baudRate\": \"%u\",\n", options->baud_rate);
+    fprintf(file, "            \"dataBits\": \"%u\",\n", options->data_bits);
+    fprintf(file, "            \"parity\": \"%s\",\n", parity);
+    fprintf(file, "            \"stopBits\": \"%u\",\n", options->stop_bits);
+    fprintf(file, "            \"operations\": [\n");
+    for (size_t i = 0; i < sizeof(function_codes); i++)
+    {
+        fprintf(file, "              {\n");
+        fprintf(file, "                \"unitId\": \"%zu\",\n", unit_i + 1);
+        fprintf(file, "                \"functionCode\": \"%u\",\n", function_codes[i]);
+        fprintf(file, "                \"startingAddress\": \"1\",\n");
+        fprintf(file, "                \"length\": \"%zu\"\n", options->read_length);
+        fprintf(file, "              }%s\n", (i + 1 < sizeof(function_codes)) ? "," : "");
+    }
+    fprintf(file, "            ]\n");
+    fprintf(file, "          }%s\n", (unit_i + 1 < options->unit_count) ? "," : "");
+}
+//a gateway config in the layout of modbus_lin.json that polls every unit on the bus and logs the telemetry
+static int write_gateway_config(BUS * bus)
+{
+    int com_port = get_com_port(bus->options.link_path);
+    FILE * file;
+
+    if (com_port <= 0)
+    {
+        fprintf(stderr, "--config needs --link /dev/ttySn, the device modbus_read opens for COMn+1\n");
+        return -1;
+    }
+    file = fopen(bus->options.config_path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "unable to open %s\n", bus->options.config_path);
+        return -1;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"modules\": [\n");
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"name\": \"logger\",\n");
+    fprintf(file, "      \"loader\": {\n");
+    fprintf(file, "        \"name\": \"native\",\n");
+    fprintf(file, "        \"entrypoint\": {\n");
+    fprintf(file, "          \"module.path\": \"../../modules/logger/liblogger.so\"\n");
+    fprintf(file, "        }\n");
+    fprintf(file, "      },\n");
+    fprintf(file, "      \"args\": {\n");
+    fprintf(file, "        \"filename\": \"log.txt\"\n");
+    fprintf(file, "      }\n");
+    fprintf(file, "    },\n");
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"name\": \"modbus_read\",\n");
+    fprintf(file, "      \"loader\": {\n");
+    fprintf(file, "        \"name\": \"native\",\n");
+    fprintf(file, "        \"entrypoint\": {\n");
+    fprintf(file, "          \"module.path\": \"../../modules/modbus_read/libmodbus_read.so\"\n");
+    fprintf(file, "        }\n");
+    fprintf(file, "      },\n");
+    fprintf(file, "      \"args\": {\n");
+    fprintf(file, "        \"servers\": [\n");
+    for (size_t unit_i = 0; unit_i < bus->options.unit_count; unit_i++)
+        write_server_config(bus, file, com_port, unit_i);
+    fprintf(file, "        ]\n");
+    fprintf(file, "      }\n");
+    fprintf(file, "    }\n");
+    fprintf(file, "  ],\n");
+    fprintf(file, "  \"links\": [\n");
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"source\": \"modbus_read\",\n");
+    fprintf(file, "      \"sink\": \"logger\"\n");
+    fprintf(file, "    }\n");
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "unable to write %s\n", bus->options.config_path);
+        return -1;
+    }
+    return 0;
+}
+static void print_usage(const char * program)
+{
+    printf("usage: %s [options]\n", program);
+    printf("  --units N            slaves on the bus, unit ids 1 to N, default %d\n", DEFAULT_UNIT_COUNT);
+    printf("  --registers N        coils, discrete inputs, input and holding registers of each slave, default %d\n", DEFAULT_REGISTER_COUNT);
+    printf("  --baud N             baud rate the line is timed at, default %d\n", DEFAULT_BAUD_RATE);
+    printf("  --data-bits N        7 or 8, default 8\n");
+    printf("  --parity P           NONE, ODD or EVEN, default NONE\n");
+    printf("  --stop-bits N        1 or 2, default 1\n");
+    printf("  --turnaround MS      time a slave takes to answer after the request, default %d\n", DEFAULT_TURNAROUND_MS);
+    printf("  --jitter MS          the turnaround varies evenly by up to this much either way, default 0\n");
+    printf("  --chunk N            bytes the master receives at once, its UART FIFO, default %d\n", DEFAULT_CHUNK);
+    printf("  --drop RATE          share of the requests left unanswered, 0 to 1, default 0\n");
+    printf("  --exceptions RATE    share of the requests answered with exception 4, 0 to 1, default 0\n");
+    printf("  --noise RATE         share of the responses with one bit flipped, 0 to 1, default 0\n");
+    printf("  --crc-errors RATE    share of the responses with a wrong crc, 0 to 1, default 0\n");
+    printf("  --seed N             seed of the drops, exceptions, noise and jitter, default 1\n");
+    printf("  --link PATH          symlink to the terminal, /dev/ttyS9 is COM10 for modbus_read\n");
+    printf("  --config FILE        write a gateway config polling every unit through the link, then serve\n");
+    printf("  --interval MS        poll interval of the config, default %d\n", DEFAULT_INTERVAL);
+    printf("  --read-length N      cells per read operation of the config, default %d\n", DEFAULT_READ_LENGTH);
+}
+static int parse_options(int argc, char ** argv, BUS_OPTIONS * options)
+{
+    static const struct option long_options[] =
+    {
+        { "units", required_argument, NULL, 'n' },
+        { "registers", required_argument, NULL, 'r' },
+        { "baud", required_argument, NULL, 'b' },
+        { "data-bits", required_argument, NULL, 'D' },
+        { "parity", required_argument, NULL, 'P' },
+        { "stop-bits", required_argument, NULL, 'T' },
+        { "turnaround", required_argument, NULL, 't' },
+        { "jitter", required_argument, NULL, 'j' },
+        { "chunk", required_argument, NULL, 'k' },
+        { "drop", required_argument, NULL, 'd' },
+        { "exceptions", required_argument, NULL, 'e' },
+        { "noise", required_argument, NULL, 'N' },
+        { "crc-errors", required_argument, NULL, 'C' },
+        { "seed", required_argument, NULL, 's' },
+        { "link", required_argument, NULL, 'l' },
+        { "config", required_argument, NULL, 'c' },
+        { "interval", required_argument, NULL, 'i' },
+        { "read-length", required_argument, NULL, 'L' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int option;
+
+    options->unit_count = DEFAULT_UNIT_COUNT;
+    options->register_count = DEFAULT_REGISTER_COUNT;
+    options->baud_rate = DEFAULT_BAUD_RATE;
+    options->data_bits = 8;
+    options->parity = 'N';
+    options->stop_bits = 1;
+    options->turnaround_ms = DEFAULT_TURNAROUND_MS;
+    options->jitter_ms = 0;
+    options->chunk = DEFAULT_CHUNK;
+    options->drop_rate = 0;
+    options->exception_rate = 0;
+    options->noise_rate = 0;
+    options->crc_error_rate = 0;
+    options->seed = 1;
+    options->link_path = NULL;
+    options->config_path = NULL;
+    options->interval = DEFAULT_INTERVAL;
+    options->read_length = DEFAULT_READ_LENGTH;
+
+    while ((option = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'n': options->unit_count = strtoul(optarg, NULL, 10); break;
+        case 'r': options->register_count = strtoul(optarg, NULL, 10); break;
+        case 'b': options->baud_rate = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'D': options->data_bits = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'P': options->parity = optarg[0]; break;
+        case 'T': options->stop_bits = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 't': options->turnaround_ms = atof(optarg); break;
+        case 'j': options->jitter_ms = atof(optarg); break;
+        case 'k': options->chunk = strtoul(optarg, NULL, 10); break;
+        case 'd': options->drop_rate = atof(optarg); break;
+        case 'e': options->exception_rate = atof(optarg); break;
+        case 'N': options->noise_rate = atof(optarg); break;
+        case 'C': options->crc_error_rate = atof(optarg); break;
+        case 's': options->seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+        case 'l': options->link_path = optarg; break;
+        case 'c': options->config_path = optarg; break;
+        case 'i': options->interval = strtoul(optarg, NULL, 10); break;
+        case 'L': options->read_length = strtoul(optarg, NULL, 10); break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (options->unit_count == 0 || options->unit_count > MAX_UNIT_COUNT || options->register_count == 0 ||
+        options->register_count > FARM_MAX_REGISTER_COUNT || options->read_length == 0 || options->read_length > options->register_count ||
+        options->baud_rate == 0 || (options->data_bits != 7 && options->data_bits != 8) ||
+        (options->parity != 'N' && options->parity != 'O' && options->parity != 'E') ||
+        (options->stop_bits != 1 && options->stop_bits != 2) || options->chunk == 0)
+    {
+        fprintf(stderr, "invalid options, at most %d units and the read length must be within the register map\n", MAX_UNIT_COUNT);
+        return -1;
+    }
+    return 0;
+}
+int main(int argc, char ** argv)
+{
+    BUS bus;
+    int result = 1;
+
+    memset(&bus, 0, sizeof(bus));
+    bus.master_fd = -1;
+    bus.slave_fd = -1;
+    if (parse_options(argc, argv, &bus.options) != 0)
+        return 1;
+    bus.random_state = farm_spread_seed(bus.options.seed);
+    bus.start_us = farm_get_monotonic_us();
+    set_line_timing(&bus);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    if (open_bus(&bus) == 0 && (bus.options.config_path == NULL || write_gateway_config(&bus) == 0))
+    {
+        printf("%zu units on %s%s%s, %u baud, %lluus per character\n", bus.options.unit_count, bus.slave_name,
+            bus.linked ? " linked as " : "", bus.linked ? bus.options.link_path : "", bus.options.baud_rate, (unsigned long long)bus.char_us);
+        fflush(stdout);
+        run_bus(&bus);
+        printf("%llu requests, %llu responses, %llu broadcasts, %llu unaddressed, %llu bad requests, %llu gap violations, %llu collisions\n",
+            bus.requests, bus.responses, bus.broadcasts, bus.unaddressed, bus.bad_requests, bus.gap_violations, bus.collisions);
+        printf("%llu dropped, %llu exceptions, %llu noise, %llu crc errors\n", bus.dropped, bus.exceptions, bus.noise, bus.crc_errors);
+        result = 0;
+    }
+    close_bus(&bus);
+    return result;
+}
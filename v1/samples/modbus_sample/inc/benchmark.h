@@ -0,0 +1,12 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <stddef.h>
+
+//runs the modbus_read module of the gateway config against a counting sink for duration_s seconds and writes the results as JSON to report_path, or stdout when NULL, returns 0 on success
+extern int run_benchmark(const char * config_path, size_t duration_s, const char * report_path);
+
+#endif /*BENCHMARK_H*/
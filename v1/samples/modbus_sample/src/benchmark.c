@@ -0,0 +1,444 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+//headless throughput benchmark: the modbus_read module of a gateway config publishes to a sink that only counts
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+#include "broker.h"
+#include "module.h"
+#include "message.h"
+#include "parson.h"
+#include "azure_c_shared_utility/constmap.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "modbus_read.h"
+#include "modbus_stats.h"
+#include "benchmark.h"
+
+#define MAC_ADDRESS_LEN 18
+//the reads are counted from the stats messages, the servers without a "statsInterval" get this one
+#define BENCHMARK_STATS_INTERVAL "1000"
+
+//what a server of the config tells the sink about its telemetry
+typedef struct BENCHMARK_DEVICE_TAG
+{
+    char mac_address[MAC_ADDRESS_LEN];
+    uint64_t interval_us;
+    uint64_t last_publish_us;
+    //the responses its stats messages counted and the time they cover
+    uint64_t responses;
+    uint64_t stats_ms;
+}BENCHMARK_DEVICE;
+
+typedef struct BENCHMARK_COUNTERS_TAG
+{
+    uint64_t telemetry;
+    uint64_t requests;
+    uint64_t responses;
+    double reads_per_sec;
+    uint64_t values;
+    uint64_t stats;
+    uint64_t others;
+    //how much later than a whole number of its intervals after the previous one each publish of a device arrived
+    MODBUS_LATENCY_HISTOGRAM publish_latency;
+}BENCHMARK_COUNTERS;
+
+typedef struct BENCHMARK_TAG
+{
+    BENCHMARK_DEVICE * devices;
+    size_t device_count;
+    LOCK_HANDLE lock;
+    BENCHMARK_COUNTERS counters;
+}BENCHMARK;
+
+static uint64_t get_monotonic_us(void)
+{
+#ifdef WIN32
+    return (uint64_t)GetTickCount64() * 1000;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)(now.tv_nsec / 1000);
+#endif
+}
+static void get_process_usage(uint64_t * cpu_us, uint64_t * peak_rss_kb)
+{
+#ifdef WIN32
+    FILETIME creation, exit, kernel, user;
+    PROCESS_MEMORY_COUNTERS memory;
+
+    *cpu_us = 0;
+    *peak_rss_kb = 0;
+    if (GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    {
+        //FILETIME counts 100ns
+        *cpu_us = ((((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) + (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) / 10;
+    }
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+        *peak_rss_kb = memory.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+
+    *cpu_us = 0;
+    *peak_rss_kb = 0;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        *cpu_us = (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+        //kilobytes on Linux
+        *peak_rss_kb = (uint64_t)usage.ru_maxrss;
+    }
+#endif
+}
+static int compare_devices(const void * a, const void * b)
+{
+    return strcmp(((const BENCHMARK_DEVICE *)a)->mac_address, ((const BENCHMARK_DEVICE *)b)->mac_address);
+}
+//the module upper-cases the "macAddress" of the config and its messages carry that
+static bool copy_mac_address(char * out, const char * mac_address)
+{
+    size_t len;
+
+    if (mac_address == NULL || (len = strlen(mac_address)) >= MAC_ADDRESS_LEN)
+        return false;
+    for (size_t i = 0; i < len; i++)
+        out[i] = (char)toupper((unsigned char)mac_address[i]);
+    out[len] = '\0';
+    return true;
+}
+static BENCHMARK_DEVICE * find_device(BENCHMARK * benchmark, const char * mac_address)
+{
+    BENCHMARK_DEVICE key;
+
+    if (!copy_mac_address(key.mac_address, mac_address))
+        return NULL;
+    return bsearch(&key, benchmark->devices, benchmark->device_count, sizeof(BENCHMARK_DEVICE), compare_devices);
+}
+//every cell of a telemetry message is one "address_..." member
+static uint64_t count_values(const CONSTBUFFER * content)
+{
+    static const char key[] = "\"address_";
+    uint64_t count = 0;
+
+    if (content == NULL || content->size < sizeof(key) - 1)
+        return 0;
+    for (size_t i = 0; i <= content->size - (sizeof(key) - 1); i++)
+    {
+        if (content->buffer[i] == '"' && memcmp(content->buffer + i, key, sizeof(key) - 1) == 0)
+            count++;
+    }
+    return count;
+}
+static uint64_t get_stats_count(JSON_Object * stats, const char * name)
+{
+    const char * count = json_object_get_string(stats, name);
+    return (count != NULL) ? strtoull(count, NULL, 10) : 0;
+}
+//the "requests" and "responses" a stats message counts over its "interval" since the previous one of its server
+static void count_requests(const CONSTBUFFER * content, uint64_t * requests, uint64_t * responses, uint64_t * interval_ms)
+{
+    char * text = (content != NULL) ? malloc(content->size + 1) : NULL;
+    JSON_Value * stats = NULL;
+
+    *requests = 0;
+    *responses = 0;
+    *interval_ms = 0;
+    if (text == NULL)
+    {
+        LogError("unable to read a stats message");
+        return;
+    }
+    memcpy(text, content->buffer, content->size);
+    text[content->size] = '\0';
+    stats = json_parse_string(text);
+    if (stats == NULL)
+    {
+        LogError("unable to parse a stats message");
+    }
+    else
+    {
+        *requests = get_stats_count(json_value_get_object(stats), "requests");
+        *responses = get_stats_count(json_value_get_object(stats), "responses");
+        *interval_ms = get_stats_count(json_value_get_object(stats), "interval");
+        json_value_free(stats);
+    }
+    free(text);
+}
+//the publishes of a device follow its schedule, but a cycle without changes, or a missed one, publishes nothing, so a gap is measured from the nearest whole number of intervals
+static uint64_t get_publish_lateness(const BENCHMARK_DEVICE * device, uint64_t now)
+{
+    uint64_t gap = now - device->last_publish_us;
+    uint64_t intervals;
+
+    if (device->interval_us == 0)
+        return 0;
+    intervals = (gap + device->interval_us / 2) / device->interval_us;
+    if (intervals == 0)
+        intervals = 1;
+    return (gap > intervals * device->interval_us) ? gap - intervals * device->interval_us : 0;
+}
+static void BenchmarkSink_Receive(MODULE_HANDLE moduleHandle, MESSAGE_HANDLE messageHandle)
+{
+    BENCHMARK * benchmark = (BENCHMARK *)moduleHandle;
+    uint64_t now = get_monotonic_us();
+    CONSTMAP_HANDLE properties = Message_GetProperties(messageHandle);
+
+    if (properties == NULL)
+    {
+        LogError("unable to get the properties of a message");
+    }
+    else
+    {
+        if (ConstMap_ContainsKey(properties, "modbusRead"))
+        {
+            uint64_t values = count_values(Message_GetContent(messageHandle));
+            BENCHMARK_DEVICE * device = find_device(benchmark, ConstMap_GetValue(properties, "macAddress"));
+
+            (void)Lock(benchmark->lock);
+            benchmark->counters.telemetry++;
+            benchmark->counters.values += values;
+            if (device != NULL)
+            {
+                if (device->last_publish_us != 0)
+                    modbus_histogram_record(&benchmark->counters.publish_latency, get_publish_lateness(device, now));
+                device->last_publish_us = now;
+            }
+            (void)Unlock(benchmark->lock);
+        }
+        else if (ConstMap_ContainsKey(properties, "modbusStats"))
+        {
+            uint64_t requests, responses, interval_ms;
+            BENCHMARK_DEVICE * device = find_device(benchmark, ConstMap_GetValue(properties, "macAddress"));
+            count_requests(Message_GetContent(messageHandle), &requests, &responses, &interval_ms);
+
+            (void)Lock(benchmark->lock);
+            benchmark->counters.stats++;
+            benchmark->counters.requests += requests;
+            benchmark->counters.responses += responses;
+            if (device != NULL)
+            {
+                device->responses += responses;
+                device->stats_ms += interval_ms;
+            }
+            (void)Unlock(benchmark->lock);
+        }
+        else
+        {
+            (void)Lock(benchmark->lock);
+            benchmark->counters.others++;
+            (void)Unlock(benchmark->lock);
+        }
+        ConstMap_Destroy(properties);
+    }
+}
+static const MODULE_API_1 benchmarkSinkInterface =
+{
+    {MODULE_API_VERSION_1},
+
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    BenchmarkSink_Receive,
+    NULL
+};
+//the args of the module named modbus_read, or loaded from a modbus_read library
+static JSON_Value * find_modbus_args(JSON_Object * root)
+{
+    JSON_Array * modules = json_object_get_array(root, "modules");
+
+    for (size_t i = 0; i < json_array_get_count(modules); i++)
+    {
+        JSON_Object * module = json_array_get_object(modules, i);
+        const char * name = json_object_get_string(module, "name");
+        const char * path = json_object_get_string(json_object_get_object(json_object_get_object(module, "loader"), "entrypoint"), "module.path");
+
+        if ((name != NULL && strcmp(name, "modbus_read") == 0) || (path != NULL && strstr(path, "modbus_read") != NULL))
+            return json_object_get_value(module, "args");
+    }
+    return NULL;
+}
+static int load_devices(BENCHMARK * benchmark, JSON_Value * args)
+{
+    //the args are either the server array or an object holding it
+    JSON_Array * servers = (json_value_get_type(args) == JSONArray) ? json_value_get_array(args) : json_object_get_array(json_value_get_object(args), "servers");
+
+    benchmark->device_count = json_array_get_count(servers);
+    if (benchmark->device_count == 0)
+    {
+        LogError("no modbus servers in the config");
+        return -1;
+    }
+    benchmark->devices = calloc(benchmark->device_count, sizeof(BENCHMARK_DEVICE));
+    if (benchmark->devices == NULL)
+    {
+        LogError("unable to malloc the benchmark devices");
+        return -1;
+    }
+    for (size_t i = 0; i < benchmark->device_count; i++)
+    {
+        JSON_Object * server = json_array_get_object(servers, i);
+        const char * mac_address = json_object_get_string(server, "macAddress");
+        const char * interval = json_object_get_string(server, "interval");
+
+        (void)copy_mac_address(benchmark->devices[i].mac_address, mac_address);
+        benchmark->devices[i].interval_us = (interval != NULL) ? (uint64_t)atoi(interval) * 1000 : 0;
+        if (json_object_get_string(server, "statsInterval") == NULL && json_object_set_string(server, "statsInterval", BENCHMARK_STATS_INTERVAL) != JSONSuccess)
+        {
+            LogError("unable to set the statsInterval of a modbus server");
+            return -1;
+        }
+    }
+    qsort(benchmark->devices, benchmark->device_count, sizeof(BENCHMARK_DEVICE), compare_devices);
+    return 0;
+}
+static double per_second(uint64_t count, uint64_t elapsed_us)
+{
+    return (elapsed_us > 0) ? (double)count * 1000000 / elapsed_us : 0;
+}
+//the stats messages of a device cover the run but its last moments, so each device's reads are divided by the time its messages cover
+static double get_reads_per_sec(const BENCHMARK * benchmark)
+{
+    double reads_per_sec = 0;
+
+    for (size_t i = 0; i < benchmark->device_count; i++)
+        reads_per_sec += per_second(benchmark->devices[i].responses, benchmark->devices[i].stats_ms * 1000);
+    return reads_per_sec;
+}
+static int write_report(BENCHMARK * benchmark, const BENCHMARK_COUNTERS * counters, uint64_t elapsed_us, uint64_t cpu_us, uint64_t peak_rss_kb, const char * report_path)
+{
+    const MODBUS_LATENCY_HISTOGRAM * latency = &counters->publish_latency;
+    FILE * file = (report_path != NULL) ? fopen(report_path, "w") : stdout;
+    int result = 0;
+
+    if (file == NULL)
+    {
+        LogError("unable to open %s", report_path);
+        return -1;
+    }
+    fprintf(file, "{\"durationMs\":%llu,\"devices\":%zu,\"telemetryMessages\":%llu,\"statsMessages\":%llu,\"otherMessages\":%llu,",
+        (unsigned long long)(elapsed_us / 1000), benchmark->device_count, (unsigned long long)counters->telemetry, (unsigned long long)counters->stats, (unsigned long long)counters->others);
+    fprintf(file, "\"requests\":%llu,\"reads\":%llu,\"readsPerSec\":%.1f,\"values\":%llu,\"valuesPerSec\":%.1f,",
+        (unsigned long long)counters->requests, (unsigned long long)counters->responses, counters->reads_per_sec,
+        (unsigned long long)counters->values, per_second(counters->values, elapsed_us));
+    fprintf(file, "\"publishLatencyUs\":{\"count\":%u,\"mean\":%llu,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u},",
+        latency->count, (unsigned long long)((latency->count > 0) ? latency->sum_us / latency->count : 0), modbus_histogram_percentile(latency, 50), modbus_histogram_percentile(latency, 90),
+        modbus_histogram_percentile(latency, 99), latency->max_us);
+    fprintf(file, "\"cpuMs\":%llu,\"cpuPercent\":%.1f,\"peakRssKb\":%llu}\n",
+        (unsigned long long)(cpu_us / 1000), (elapsed_us > 0) ? (double)cpu_us * 100 / elapsed_us : 0, (unsigned long long)peak_rss_kb);
+    if (report_path != NULL && fclose(file) != 0)
+    {
+        LogError("unable to write %s", report_path);
+        result = -1;
+    }
+    return result;
+}
+static int run_module(BENCHMARK * benchmark, BROKER_HANDLE broker, const char * args, size_t duration_s, const char * report_path)
+{
+    const MODULE_API_1 * api = (const MODULE_API_1 *)MODULE_STATIC_GETAPI(MODBUSREAD_MODULE)(MODULE_API_VERSION_1);
+    MODULE sink = { (const MODULE_API *)&benchmarkSinkInterface, (MODULE_HANDLE)benchmark };
+    MODULE modbus = { (const MODULE_API *)api, NULL };
+    BROKER_LINK_DATA link;
+    BENCHMARK_COUNTERS counters;
+    uint64_t start_us, elapsed_us, start_cpu_us, cpu_us, peak_rss_kb;
+    void * configuration = api->Module_ParseConfigurationFromJson(args);
+    int result = -1;
+
+    if (configuration == NULL)
+    {
+        LogError("unable to parse the modbus_read args");
+        return -1;
+    }
+    modbus.module_handle = api->Module_Create(broker, configuration);
+    api->Module_FreeConfiguration(configuration);
+    if (modbus.module_handle == NULL)
+    {
+        LogError("unable to create the modbus_read module");
+        return -1;
+    }
+    link.module_source = modbus.module_handle;
+    link.module_sink = sink.module_handle;
+    if (Broker_AddModule(broker, &sink) != BROKER_OK || Broker_AddModule(broker, &modbus) != BROKER_OK || Broker_AddLink(broker, &link) != BROKER_OK)
+    {
+        LogError("unable to attach the benchmark sink to the broker");
+    }
+    else
+    {
+        get_process_usage(&start_cpu_us, &peak_rss_kb);
+        start_us = get_monotonic_us();
+        api->Module_Start(modbus.module_handle);
+        ThreadAPI_Sleep((unsigned int)(duration_s * 1000));
+
+        //the counters are taken at the end of the run, the messages still in the broker are not
+        (void)Lock(benchmark->lock);
+        counters = benchmark->counters;
+        counters.reads_per_sec = get_reads_per_sec(benchmark);
+        (void)Unlock(benchmark->lock);
+        elapsed_us = get_monotonic_us() - start_us;
+        get_process_usage(&cpu_us, &peak_rss_kb);
+        result = write_report(benchmark, &counters, elapsed_us, cpu_us - start_cpu_us, peak_rss_kb, report_path);
+        (void)Broker_RemoveLink(broker, &link);
+    }
+    (void)Broker_RemoveModule(broker, &modbus);
+    api->Module_Destroy(modbus.module_handle);
+    (void)Broker_RemoveModule(broker, &sink);
+    return result;
+}
+int run_benchmark(const char * config_path, size_t duration_s, const char * report_path)
+{
+    BENCHMARK benchmark;
+    JSON_Value * root = json_parse_file(config_path);
+    JSON_Value * args = (root != NULL) ? find_modbus_args(json_value_get_object(root)) : NULL;
+    char * args_string = NULL;
+    BROKER_HANDLE broker = NULL;
+    int result = -1;
+
+    memset(&benchmark, 0, sizeof(benchmark));
+    if (root == NULL)
+    {
+        LogError("unable to parse %s", config_path);
+    }
+    else if (args == NULL)
+    {
+        LogError("no modbus_read module in %s", config_path);
+    }
+    else if (load_devices(&benchmark, args) == 0)
+    {
+        if ((args_string = json_serialize_to_string(args)) == NULL)
+        {
+            LogError("unable to serialize the modbus_read args");
+        }
+        else if ((benchmark.lock = Lock_Init()) == NULL)
+        {
+            LogError("unable to create the benchmark lock");
+        }
+        else if ((broker = Broker_Create()) == NULL)
+        {
+            LogError("unable to create the broker");
+        }
+        else
+        {
+            result = run_module(&benchmark, broker, args_string, duration_s, report_path);
+            Broker_Destroy(broker);
+        }
+    }
+    if (benchmark.lock != NULL)
+        (void)Lock_Deinit(benchmark.lock);
+    free(benchmark.devices);
+    json_free_serialized_string(args_string);
+    json_value_free(root);
+    return result;
+}
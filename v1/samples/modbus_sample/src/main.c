@@ -2,20 +2,44 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "gateway.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/vector.h"
 #include "azure_c_shared_utility/platform.h"
+#include "benchmark.h"
+
+#define BENCHMARK_OPTION "--benchmark"
+#define DEFAULT_BENCHMARK_SECONDS 60
 
 
 int main(int argc, char** argv)
 {
     GATEWAY_HANDLE gateway;
-    if (argc != 2)
+    int result = 0;
+    if (argc >= 3 && argc <= 5 && strcmp(argv[1], BENCHMARK_OPTION) == 0)
+    {
+        //headless: only the modbus_read module of the config runs, its messages go to a counting sink
+        size_t seconds = (argc >= 4) ? (size_t)atoi(argv[3]) : DEFAULT_BENCHMARK_SECONDS;
+        if (seconds == 0 || platform_init() != 0)
+        {
+            LogError("Failed to start the benchmark.");
+            result = 1;
+        }
+        else
+        {
+            result = (run_benchmark(argv[2], seconds, (argc == 5) ? argv[4] : NULL) == 0) ? 0 : 1;
+            platform_deinit();
+        }
+    }
+    else if (argc != 2)
     {
         printf("usage: modbus_read_sample configFile\n");
         printf("where configFile is the name of the file that contains the Gateway configuration\n");
+        printf("   or: modbus_read_sample " BENCHMARK_OPTION " configFile [seconds [reportFile]]\n");
+        printf("which polls the modbus_read servers of configFile for %d seconds by default and reports the throughput as JSON\n", DEFAULT_BENCHMARK_SECONDS);
     }
     else
     {
@@ -39,5 +63,5 @@ int main(int argc, char** argv)
 			LogError("Failed to initialize the platform.");
 		}
     }
-    return 0;
+    return result;
 }